@@ -16,38 +16,53 @@
 #include <vlc_url.h>
 #include <vlc_fs.h>
 
+#include <time.h>
+
+#include "fpvosd.h"
+#include "fpvosd_blit.h"
+
 //#define DOMAIN  "vlc-fpvosd"
 #define _(str)  dgettext(DOMAIN, str)
 #define N_(str) (str)
 
 
-#define FONT_BYTES_PER_PIXEL     4
-// Overlay dimensions
-#define DISPLAY_OVERLAY_WIDTH    1440
-#define DISPLAY_OVERLAY_HEIGHT   810
-// Dimensions for OSD
-#define DISPLAY_ORIGINAL_WIDTH   1440
-#define DISPLAY_ORIGINAL_HEIGHT  792
+#define FOURCC_CODE VLC_FOURCC('M','S','P','O')
 
-// OSD grid size
-#define MAX_X  60
-#define MAX_Y  22
+// Statistics are published to object variables not more often than this
+#define STATS_PUBLISH_INTERVAL  CLOCK_FREQ
+// Histogram: 4 buckets per power of two
+#define STATS_HIST_BUCKETS      256
 
-// OSD font size
-#define FONT_WIDTH   24
-#define FONT_HEIGHT  36
+// Block carries no map: the frame is in the canvas cache
+#define BLOCK_FLAG_OSD_CACHED  (1 << BLOCK_FLAG_PRIVATE_SHIFT)
+// Block carries several frames: uint32_t count, then osd_batch_entry_t + data each
+#define BLOCK_FLAG_OSD_BATCH   (1 << (BLOCK_FLAG_PRIVATE_SHIFT + 1))
+// A batch takes frames up to this far ahead of the demux barrier
+#define BATCH_LOOKAHEAD        (CLOCK_FREQ / 4)
 
-// MSP-OSD
-#define MAGIC "MSPOSD"
-#define MSPOSD_VERSION 1
+// Styled font atlases kept by the decoder
+#define STYLE_VARIANTS     4
+#define STYLE_COLORS_MAX   8
+#define STYLE_OUTLINE_MAX  3
+#define STYLE_SHADOW_MAX   4
 
-#define FOURCC_CODE VLC_FOURCC('M','S','P','O')
+// Autoload: directories with cached list of .osd files
+#define DIR_CACHE_SIZE     8
+// Directory mtime is checked not more often than this
+#define DIR_CACHE_RECHECK  (5 * CLOCK_FREQ)
 
 
 #define CFG_PREFIX       "fpvosd-"
 #define CFG_FONT_FOLDER  CFG_PREFIX "font-folder"
 #define CFG_FPS          CFG_PREFIX "fps"
 #define CFG_AUTOLOAD     CFG_PREFIX "autoload"
+#define CFG_CHUNKS       CFG_PREFIX "chunks"
+#define CFG_CACHE_SIZE   CFG_PREFIX "cache-size"
+#define CFG_LOW_MEMORY   CFG_PREFIX "low-memory"
+#define CFG_MEM_BUDGET   CFG_PREFIX "mem-budget"
+#define CFG_DECIMATE     CFG_PREFIX "decimate"
+#define CFG_BATCH        CFG_PREFIX "batch"
+#define CFG_STYLE        CFG_PREFIX "style"
 
 
 #define FONT_FOLDER_TEXT N_("Font folder")
@@ -59,6 +74,27 @@
 #define AUTOLOAD_TEXT N_("Autoload .osd")
 #define AUTOLOAD_LONGTEXT N_("Autoload .osd file if exists one with same name. Need enable interface module")
 
+#define CHUNKS_TEXT N_("Next chunks")
+#define CHUNKS_LONGTEXT N_("Further .osd files of a split recording, separated by '|'. They are played after the opened file as one OSD track. Set per video as an input option, never saved.")
+
+#define CACHE_SIZE_TEXT N_("Canvas cache size (MB)")
+#define CACHE_SIZE_LONGTEXT N_("Memory for recently rendered OSD frames, reused on frame stepping and seeking back. 0 to disable")
+
+#define LOW_MEMORY_TEXT N_("Low memory mode")
+#define LOW_MEMORY_LONGTEXT N_("Run-length encode the frame index and use the canvas cache only within the memory budget")
+
+#define MEM_BUDGET_TEXT N_("Memory budget per file (KB)")
+#define MEM_BUDGET_LONGTEXT N_("Memory for the frame index and the canvas cache of one .osd file. 0 for no limit")
+
+#define DECIMATE_TEXT N_("Skip frames on fast playback")
+#define DECIMATE_LONGTEXT N_("At playback rates above 1x read and send only the OSD frames that can be shown between video frames")
+
+#define BATCH_TEXT N_("Frames per block")
+#define BATCH_LONGTEXT N_("Number of OSD frames passed from the demuxer to the decoder at once. Larger values reduce CPU load. 1 to disable")
+
+#define STYLE_TEXT N_("Style")
+#define STYLE_LONGTEXT N_("OSD style, ex. \"opacity=70,outline=1,shadow=2,color=FFFFFF:FFFF00\": opacity in percent, black outline and shadow in pixels, font color replacements (RGB)")
+
 #define HELP_TEXT N_( \
     "FPV-OSD\n" \
     "It opens .osd file as subtitle and show OSD in realtime" \
@@ -71,6 +107,8 @@
 static int  OpenCodec( vlc_object_t * );
 static void CloseCodec( vlc_object_t * );
 static int Decode( decoder_t *, block_t * );
+static void Flush( decoder_t * );
+static void DecodeBlock( decoder_t *, block_t * );
 static int  OpenDemux( vlc_object_t * );
 static void CloseDemux( vlc_object_t * );
 static int Demux( demux_t * );
@@ -90,6 +128,15 @@ vlc_module_begin ()
 	add_directory( CFG_FONT_FOLDER, NULL, FONT_FOLDER_TEXT, FONT_FOLDER_LONGTEXT, false )
 	add_float( CFG_FPS, 60, FPS_TEXT, FPS_LONGTEXT, false )
 	add_bool ( CFG_AUTOLOAD, true, AUTOLOAD_TEXT, AUTOLOAD_LONGTEXT, true )
+	add_string( CFG_CHUNKS, NULL, CHUNKS_TEXT, CHUNKS_LONGTEXT, true )
+	    change_safe()
+	    change_volatile()
+	add_integer_with_range( CFG_CACHE_SIZE, 64, 0, 2048, CACHE_SIZE_TEXT, CACHE_SIZE_LONGTEXT, true )
+	add_bool ( CFG_LOW_MEMORY, false, LOW_MEMORY_TEXT, LOW_MEMORY_LONGTEXT, true )
+	add_integer_with_range( CFG_MEM_BUDGET, 0, 0, 2097152, MEM_BUDGET_TEXT, MEM_BUDGET_LONGTEXT, true )
+	add_bool ( CFG_DECIMATE, true, DECIMATE_TEXT, DECIMATE_LONGTEXT, true )
+	add_integer_with_range( CFG_BATCH, 1, 1, 64, BATCH_TEXT, BATCH_LONGTEXT, true )
+	add_string( CFG_STYLE, NULL, STYLE_TEXT, STYLE_LONGTEXT, false )
     set_capability( "spu decoder", 10 )
     set_callbacks( OpenCodec, CloseCodec )
 
@@ -109,90 +156,968 @@ vlc_module_end ()
  * Local structures
  ****************************************************************************/
 
-// OSD (.osd) file header
-typedef struct file_header_s
-{
-    char magic[7];
-    uint16_t version;
-    struct rec_config_s
-    {
-        uint8_t char_width;
-        uint8_t char_height;
-        uint8_t font_width;
-        uint8_t font_height;
-        uint16_t x_offset;
-        uint16_t y_offset;
-        uint8_t font_variant;
-    } __attribute__((packed)) config;
-} __attribute__((packed)) file_header_t;
-
-// Font variants
-enum  font_variant_e
-{
-    FONT_VARIANT_GENERIC = 0,
-    FONT_VARIANT_BETAFLIGHT = 1,
-    FONT_VARIANT_INAV = 2,
-    FONT_VARIANT_ARDUPILOT = 3,
-    FONT_VARIANT_KISS_ULTRA = 4,
-    FONT_VARIANT_QUICKSILVER = 5,
-	FONT_VARIANT__SIZE
-};
-
-// String codes for font variants
-static const char * font_variant_str[FONT_VARIANT__SIZE] = {
-        [FONT_VARIANT_GENERIC]="",
-        [FONT_VARIANT_BETAFLIGHT]="_bf",
-        [FONT_VARIANT_INAV]="_inav",
-        [FONT_VARIANT_ARDUPILOT]="_ardu",
-        [FONT_VARIANT_KISS_ULTRA]="_ultra",
-        [FONT_VARIANT_QUICKSILVER]="_quic",
-};
-
-// Frame header
-typedef struct frame_header_s {
-	uint32_t frame_idx;
-	uint32_t size;
-} __attribute__((packed)) frame_header_t;
-
+/* Performance counters. Build with -DFPVOSD_NO_STATS (make STATS=0)
+ * to strip them */
+typedef struct osd_hist_s {
+    uint64_t    count;
+    uint64_t    buckets[STATS_HIST_BUCKETS];
+} osd_hist_t;
+
+typedef struct osd_decoder_stats_s {
+    uint64_t    frames_decoded;     // rendered
+    uint64_t    frames_cached;      // served from the canvas cache
+    uint64_t    frames_skipped;     // corrupted or without map
+    uint64_t    glyphs;
+    uint64_t    alloc_bytes;
+    osd_hist_t  render_ns;
+    mtime_t     published;
+} osd_decoder_stats_t;
+
+typedef struct osd_demux_stats_s {
+    mtime_t     index_time;         // us
+    uint64_t    bytes_read;
+    uint64_t    blocks_sent;
+    uint64_t    blocks_decimated;   // not read on fast playback
+    uint64_t    alloc_bytes;
+    uint64_t    index_bytes;
+    mtime_t     published;
+} osd_demux_stats_t;
+
+// ES extra data: file header followed by plugin private fields
+typedef struct osd_es_extra_s {
+    file_header_t header;
+    uint32_t      cache_id;     // 0: no canvas cache
+} __attribute__((packed)) osd_es_extra_t;
+
+// Frame in a batch block. Subpictures are ephemeral, so no length
+typedef struct osd_batch_entry_s {
+    int64_t     pts;
+    uint32_t    size;           // 0: the frame is in the canvas cache
+} __attribute__((packed)) osd_batch_entry_t;
+
+// Rendered OSD frame
+typedef struct osd_canvas_s {
+    mtime_t     key;            // pts of the frame
+    picture_t   *pic;
+    size_t      size;
+    unsigned    pins;           // sent without map, not looked up yet
+    bool        b_stale;        // rendered with another style
+    struct osd_canvas_s *prev, *next;
+} osd_canvas_t;
+
+// LRU cache of rendered frames shared by the demuxer and the decoder of an ES
+typedef struct osd_cache_s {
+    vlc_mutex_t lock;
+    uint32_t    id;
+    unsigned    refs;
+    size_t      budget;
+    size_t      used;
+    osd_canvas_t *head;         // most recently used
+    osd_canvas_t *tail;
+    uint64_t    hits;           // frames not rendered by the decoder
+    uint64_t    misses;
+    uint64_t    reads_skipped;  // frames not read by the demuxer
+    struct osd_cache_s *next;
+} osd_cache_t;
+
+// OSD style baked into a font atlas
+typedef struct osd_style_s {
+    int         opacity;        // %
+    int         outline;        // px
+    int         shadow;         // px
+    unsigned    colors;
+    uint32_t    color_from[STYLE_COLORS_MAX];   // 0xRRGGBB
+    uint32_t    color_to[STYLE_COLORS_MAX];
+} osd_style_t;
+
+typedef struct osd_atlas_s {
+    osd_style_t style;
+    picture_t   *pic;
+} osd_atlas_t;
 
 struct decoder_sys_t
 {
     uint8_t * p_raw_font_page_1;
     uint8_t * p_raw_font_page_2;
     picture_t * p_pic_font_page_1;
+    osd_blit_t blit;            // kernel for the font atlas
+    osd_atlas_t atlases[STYLE_VARIANTS];    // styled, most recently used first
+    unsigned atlas_count;
+    char * psz_style;           // under font_lock
+    bool b_style_changed;
+    osd_cache_t * cache;
+    osd_decoder_stats_t stats;
+
+    // Font is loaded by font_thread; Decode() waits for font_status
+    char * fontpath;
+    vlc_thread_t font_thread;
+    bool b_font_thread;
+    vlc_mutex_t font_lock;
+    int font_status;            // VLC_SUCCESS when the atlas is ready
+    bool b_font_loading;
+    bool b_font_ready;          // font_status seen by the decoder thread
+    block_t * p_pending;        // latest frame received before the font, under font_lock
+    bool b_closing;             // under font_lock: the font thread must not render
+    mtime_t last_lookup;        // pts of the last frame, -1 after a flush
+    mtime_t open_time;
+    mtime_t font_time;
+    bool b_first_osd;
 };
 
+// Index entry. Timestamps are derived from frame_idx, stop is the start
+// of the next entry
 typedef struct osd_entry_s {
-    mtime_t start;
-    mtime_t stop;
-    size_t  blocknumber;
+    uint32_t frame_idx;
+    uint32_t block;         // frame number counted over all chunks
 } osd_entry_t;
 
-struct demux_sys_t {
-    size_t      count;
-    osd_entry_t *index;
+// Run of entries with consecutive blocks and constant frame_idx step
+typedef struct osd_run_s {
+    uint32_t first;         // number of the first entry of the run
+    uint32_t frame_idx;
+    uint32_t block;
+    uint32_t step;
+} osd_run_t;
+
+// One file of a split recording
+typedef struct osd_chunk_s {
+    stream_t    *s;
+    mtime_t     offset;     // start of the chunk in the common timeline
+    uint32_t    first_block;
+} osd_chunk_t;
+
+struct demux_sys_t {
+    size_t      count;
+    osd_entry_t *index;     // NULL when run-length encoded
+    osd_run_t   *runs;
+    size_t      run_count;
+    uint32_t    blocks;     // frames of all chunks opened so far
+    mtime_t     length;
+
+    osd_chunk_t *chunks;    // chunks[0] is the opened file
+    unsigned    chunk_count;
+
+    es_out_id_t *es;
+    osd_cache_t *cache;
+
+    size_t      current;
+    int64_t     next_date;
+    bool        b_slave;
+    bool        b_first_time;
+    double      fps;
+    bool        b_decimate;
+    unsigned    batch;      // frames per block
+    mtime_t     last_sent;  // start of the last sent frame, -1 after a seek
+    osd_demux_stats_t stats;
+};
+
+// .osd file found in a directory
+typedef struct osd_dir_entry_s {
+    char *key;      // lower-case name without ".osd"
+    char *file;     // name on disk
+} osd_dir_entry_t;
+
+// Cached list of .osd files of a directory
+typedef struct osd_dir_s {
+    char            *path;
+    osd_dir_entry_t *entries;   // sorted by key
+    size_t          count;
+    time_t          mtime;
+    mtime_t         checked;
+} osd_dir_t;
+
+struct intf_sys_t
+{
+    vlc_mutex_t lock;
+    bool b_autoload;
+    osd_dir_t   dirs[DIR_CACHE_SIZE];   // most recently used first
+    unsigned    dir_count;
+};
+
+/*****************************************************************************
+ * Local prototypes
+ *****************************************************************************/
+static void draw_osd_char(decoder_t *, const osd_plane_t *, int, int, uint16_t);
+static char * osd_find_file(intf_thread_t *, const char *);
+static void osd_dir_free(osd_dir_t *);
+
+/*****************************************************************************
+ * Statistics
+ *****************************************************************************/
+#ifndef FPVOSD_NO_STATS
+# define STATS_ADD( st, field, n )  ( (st).field += (n) )
+#else
+# define STATS_ADD( st, field, n )  ( (void)0 )
+#endif
+
+static size_t picture_size( const picture_t *pic )
+{
+    size_t size = 0;
+    for ( int i = 0; i < pic->i_planes; i++ )
+        size += (size_t)pic->p[i].i_pitch * pic->p[i].i_lines;
+    return size;
+}
+
+#ifndef FPVOSD_NO_STATS
+static uint64_t stats_now_ns( void )
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if ( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 )
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return (uint64_t)mdate() * (1000000000 / CLOCK_FREQ);
+}
+
+static unsigned stats_bucket( uint64_t v )
+{
+    unsigned msb;
+    if ( v < 4 )
+        return v;
+    msb = 63 - __builtin_clzll( v );
+    return (msb - 1) * 4 + ((v >> (msb - 2)) & 3);
+}
+
+static void stats_hist_add( osd_hist_t *h, uint64_t v )
+{
+    h->count++;
+    h->buckets[stats_bucket( v )]++;
+}
+
+// Lower bound of the bucket holding the p-th percentile
+static uint64_t stats_hist_percentile( const osd_hist_t *h, unsigned p )
+{
+    uint64_t rank = (h->count * p + 99) / 100, sum = 0;
+    unsigned b;
+
+    if ( h->count == 0 )
+        return 0;
+    for ( b = 0; b < STATS_HIST_BUCKETS - 1; b++ )
+    {
+        sum += h->buckets[b];
+        if ( sum >= rank )
+            break;
+    }
+    if ( b < 4 )
+        return b;
+    return (uint64_t)(4 | (b & 3)) << (b / 4 - 1);
+}
+
+static void stats_var_set( vlc_object_t *obj, const char *name, int64_t value )
+{
+    if ( var_Type( obj, name ) == 0 )
+        var_Create( obj, name, VLC_VAR_INTEGER );
+    var_SetInteger( obj, name, value );
+}
+
+static void stats_decoder_publish( decoder_t *decoder, bool b_force )
+{
+    osd_decoder_stats_t *st = &decoder->p_sys->stats;
+    mtime_t now = mdate();
+
+    if ( !b_force && now - st->published < STATS_PUBLISH_INTERVAL )
+        return;
+    st->published = now;
+
+    stats_var_set( VLC_OBJECT(decoder), CFG_PREFIX "frames-decoded", st->frames_decoded );
+    stats_var_set( VLC_OBJECT(decoder), CFG_PREFIX "frames-cached", st->frames_cached );
+    stats_var_set( VLC_OBJECT(decoder), CFG_PREFIX "frames-skipped", st->frames_skipped );
+    stats_var_set( VLC_OBJECT(decoder), CFG_PREFIX "glyphs", st->glyphs );
+    stats_var_set( VLC_OBJECT(decoder), CFG_PREFIX "render-p50-ns", stats_hist_percentile( &st->render_ns, 50 ) );
+    stats_var_set( VLC_OBJECT(decoder), CFG_PREFIX "render-p99-ns", stats_hist_percentile( &st->render_ns, 99 ) );
+    stats_var_set( VLC_OBJECT(decoder), CFG_PREFIX "alloc-bytes", st->alloc_bytes );
+}
+
+static void stats_demux_publish( demux_t *demux, bool b_force )
+{
+    osd_demux_stats_t *st = &demux->p_sys->stats;
+    mtime_t now = mdate();
+
+    if ( !b_force && now - st->published < STATS_PUBLISH_INTERVAL )
+        return;
+    st->published = now;
+
+    stats_var_set( VLC_OBJECT(demux), CFG_PREFIX "index-time-us", st->index_time );
+    stats_var_set( VLC_OBJECT(demux), CFG_PREFIX "bytes-read", st->bytes_read );
+    stats_var_set( VLC_OBJECT(demux), CFG_PREFIX "blocks-sent", st->blocks_sent );
+    stats_var_set( VLC_OBJECT(demux), CFG_PREFIX "blocks-decimated", st->blocks_decimated );
+    stats_var_set( VLC_OBJECT(demux), CFG_PREFIX "alloc-bytes", st->alloc_bytes );
+    stats_var_set( VLC_OBJECT(demux), CFG_PREFIX "index-bytes", st->index_bytes );
+}
+#else
+# define stats_now_ns()                         ( 0 )
+# define stats_hist_add( h, v )                 ( (void)0 )
+# define stats_decoder_publish( decoder, b )    ( (void)0 )
+# define stats_demux_publish( demux, b )        ( (void)0 )
+#endif
+
+/*****************************************************************************
+ * Canvas cache
+ *
+ * Canvases are looked up by the pts of the frame. The cache is small
+ * (a canvas is ~4.5 MB), so a linked list in LRU order is enough.
+ * Caches are registered by id, the id is passed to the decoder in the
+ * ES extra data.
+ *****************************************************************************/
+static vlc_mutex_t osd_cache_lock = VLC_STATIC_MUTEX;
+static osd_cache_t * osd_cache_list = NULL;
+static uint32_t osd_cache_last_id = 0;
+
+static osd_cache_t * osd_cache_New( size_t budget )
+{
+    osd_cache_t *cache = calloc( 1, sizeof(*cache) );
+    if ( cache == NULL )
+        return NULL;
+
+    vlc_mutex_init( &cache->lock );
+    cache->refs = 1;
+    cache->budget = budget;
+
+    vlc_mutex_lock( &osd_cache_lock );
+    cache->id = ++osd_cache_last_id;
+    if ( cache->id == 0 )
+        cache->id = ++osd_cache_last_id;
+    cache->next = osd_cache_list;
+    osd_cache_list = cache;
+    vlc_mutex_unlock( &osd_cache_lock );
+
+    return cache;
+}
+
+static osd_cache_t * osd_cache_Get( uint32_t id )
+{
+    osd_cache_t *cache;
+
+    vlc_mutex_lock( &osd_cache_lock );
+    for ( cache = osd_cache_list; cache != NULL; cache = cache->next )
+    {
+        if ( cache->id == id )
+        {
+            cache->refs++;
+            break;
+        }
+    }
+    vlc_mutex_unlock( &osd_cache_lock );
+
+    return cache;
+}
+
+static void osd_cache_Unlink( osd_cache_t *cache, osd_canvas_t *c )
+{
+    if ( c->prev )
+        c->prev->next = c->next;
+    else
+        cache->head = c->next;
+    if ( c->next )
+        c->next->prev = c->prev;
+    else
+        cache->tail = c->prev;
+}
+
+static void osd_cache_PushFront( osd_cache_t *cache, osd_canvas_t *c )
+{
+    c->prev = NULL;
+    c->next = cache->head;
+    if ( cache->head )
+        cache->head->prev = c;
+    else
+        cache->tail = c;
+    cache->head = c;
+}
+
+static void osd_cache_Release( osd_cache_t *cache )
+{
+    osd_cache_t **pp;
+
+    vlc_mutex_lock( &osd_cache_lock );
+    if ( --cache->refs > 0 )
+    {
+        vlc_mutex_unlock( &osd_cache_lock );
+        return;
+    }
+    for ( pp = &osd_cache_list; *pp != NULL; pp = &(*pp)->next )
+    {
+        if ( *pp == cache )
+        {
+            *pp = cache->next;
+            break;
+        }
+    }
+    vlc_mutex_unlock( &osd_cache_lock );
+
+    while ( cache->head )
+    {
+        osd_canvas_t *c = cache->head;
+        cache->head = c->next;
+        picture_Release( c->pic );
+        free( c );
+    }
+    vlc_mutex_destroy( &cache->lock );
+    free( cache );
+}
+
+// Must be called with cache->lock held
+static void osd_cache_Drop( osd_cache_t *cache, osd_canvas_t *c )
+{
+    osd_cache_Unlink( cache, c );
+    cache->used -= c->size;
+    picture_Release( c->pic );
+    free( c );
+}
+
+// Evicts unpinned canvases until size more bytes fit in the budget.
+// Must be called with cache->lock held
+static void osd_cache_Trim( osd_cache_t *cache, size_t size )
+{
+    for ( osd_canvas_t *c = cache->tail, *prev;
+          c != NULL && cache->used + size > cache->budget; c = prev )
+    {
+        prev = c->prev;
+        if ( c->pins == 0 )
+            osd_cache_Drop( cache, c );
+    }
+}
+
+// Must be called with cache->lock held
+static osd_canvas_t * osd_cache_Find( osd_cache_t *cache, mtime_t key )
+{
+    for ( osd_canvas_t *c = cache->head; c != NULL; c = c->next )
+    {
+        if ( c->key == key )
+        {
+            osd_cache_Unlink( cache, c );
+            osd_cache_PushFront( cache, c );
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/* Demuxer side: true if the frame needn't be read. The canvas is pinned
+ * until the decoder looks it up, so it is not evicted in between */
+static bool osd_cache_Touch( osd_cache_t *cache, mtime_t key )
+{
+    osd_canvas_t *c;
+
+    vlc_mutex_lock( &cache->lock );
+    c = osd_cache_Find( cache, key );
+    if ( c && c->b_stale )
+        c = NULL;
+    if ( c )
+    {
+        c->pins++;
+        cache->reads_skipped++;
+    }
+    vlc_mutex_unlock( &cache->lock );
+
+    return c != NULL;
+}
+
+/* Demuxer side: after a seek the frames sent so far are flushed and will not
+ * be looked up */
+static void osd_cache_Unpin( osd_cache_t *cache )
+{
+    vlc_mutex_lock( &cache->lock );
+    for ( osd_canvas_t *c = cache->head, *next; c != NULL; c = next )
+    {
+        next = c->next;
+        c->pins = 0;
+        if ( c->b_stale )
+            osd_cache_Drop( cache, c );
+    }
+    vlc_mutex_unlock( &cache->lock );
+}
+
+/* Decoder side: returns held picture or NULL. Frames are looked up in pts
+ * order: pinned canvases between the previous lookup (since, -1 after a
+ * flush) and this one were sent but dropped before the lookup, their pins
+ * are released */
+static picture_t * osd_cache_Lookup( osd_cache_t *cache, mtime_t key, mtime_t since )
+{
+    osd_canvas_t *c;
+    picture_t *pic = NULL;
+    bool b_released = false;
+
+    vlc_mutex_lock( &cache->lock );
+    for ( osd_canvas_t *next, *p = cache->head; p != NULL; p = next )
+    {
+        next = p->next;
+        if ( p->pins == 0 || p->key <= since || p->key >= key )
+            continue;
+        p->pins = 0;
+        if ( p->b_stale )
+            osd_cache_Drop( cache, p );
+        b_released = true;
+    }
+    if ( b_released )
+        osd_cache_Trim( cache, 0 );
+
+    c = osd_cache_Find( cache, key );
+    if ( c && c->b_stale && c->pins == 0 )
+    {
+        osd_cache_Drop( cache, c );
+        c = NULL;
+    }
+    if ( c )
+    {
+        pic = picture_Hold( c->pic );
+        cache->hits++;
+        if ( c->pins > 0 && --c->pins == 0 )
+        {
+            if ( c->b_stale )
+                osd_cache_Drop( cache, c );
+            else
+                osd_cache_Trim( cache, 0 );
+        }
+    }
+    else
+    {
+        cache->misses++;
+    }
+    vlc_mutex_unlock( &cache->lock );
+
+    return pic;
+}
+
+static void osd_cache_Put( osd_cache_t *cache, mtime_t key, picture_t *pic )
+{
+    size_t size = picture_size( pic );
+    osd_canvas_t *c;
+
+    if ( size > cache->budget )
+        return;
+
+    c = malloc( sizeof(*c) );
+    if ( c == NULL )
+        return;
+    c->key = key;
+    c->pic = picture_Hold( pic );
+    c->size = size;
+    c->pins = 0;
+    c->b_stale = false;
+
+    vlc_mutex_lock( &cache->lock );
+    // Pinned canvases are kept even over the budget
+    osd_cache_Trim( cache, size );
+    osd_cache_PushFront( cache, c );
+    cache->used += size;
+    vlc_mutex_unlock( &cache->lock );
+}
+
+/*****************************************************************************
+ * osd_cache_Purge: drops all canvases (they were rendered with another style)
+ *****************************************************************************
+ * Pinned canvases are still shown once for the frames already sent without
+ * map, then dropped.
+ *****************************************************************************/
+static void osd_cache_Purge( osd_cache_t *cache )
+{
+    vlc_mutex_lock( &cache->lock );
+    for ( osd_canvas_t *c = cache->head, *next; c != NULL; c = next )
+    {
+        next = c->next;
+        if ( c->pins > 0 )
+            c->b_stale = true;
+        else
+            osd_cache_Drop( cache, c );
+    }
+    vlc_mutex_unlock( &cache->lock );
+}
+
+/*****************************************************************************
+ * StyleParse: "opacity=70,outline=1,shadow=2,color=FFFFFF:FFFF00"
+ *****************************************************************************/
+static void StyleParse( vlc_object_t *obj, const char *psz_style, osd_style_t *style )
+{
+    char *dup, *item, *save = NULL;
+
+    // Zeroed: styles are compared with memcmp()
+    memset( style, 0, sizeof(*style) );
+    style->opacity = 100;
+
+    if ( psz_style == NULL || (dup = strdup( psz_style )) == NULL )
+        return;
+
+    for ( item = strtok_r( dup, ",; ", &save ); item != NULL; item = strtok_r( NULL, ",; ", &save ) )
+    {
+        unsigned from, to;
+        int value;
+
+        if ( sscanf( item, "opacity=%d", &value ) == 1 )
+            style->opacity = VLC_CLIP( value, 0, 100 );
+        else if ( sscanf( item, "outline=%d", &value ) == 1 )
+            style->outline = VLC_CLIP( value, 0, STYLE_OUTLINE_MAX );
+        else if ( sscanf( item, "shadow=%d", &value ) == 1 )
+            style->shadow = VLC_CLIP( value, 0, STYLE_SHADOW_MAX );
+        else if ( sscanf( item, "color=%x:%x", &from, &to ) == 2 && style->colors < STYLE_COLORS_MAX )
+        {
+            style->color_from[style->colors] = from & 0xFFFFFF;
+            style->color_to[style->colors] = to & 0xFFFFFF;
+            style->colors++;
+        }
+        else
+            msg_Warn( obj, "StyleParse(): unknown style \"%s\"", item );
+    }
+    free( dup );
+}
+
+static bool StyleIsPlain( const osd_style_t *style )
+{
+    return style->opacity == 100 && style->outline == 0 && style->shadow == 0 && style->colors == 0;
+}
+
+/*****************************************************************************
+ * StyleBake: makes a copy of the atlas with the style applied
+ *****************************************************************************
+ * Colors are remapped, then the outline and the shadow are drawn in black
+ * under each glyph (within its cell), then the opacity is applied.
+ *****************************************************************************/
+static picture_t * StyleBake( const picture_t *base, const osd_style_t *style )
+{
+    const int cw = FONT_WIDTH, ch = FONT_HEIGHT;
+    const int width = base->format.i_width, height = base->format.i_height;
+    picture_t *pic;
+    uint8_t *alpha;
+
+    pic = picture_New( VLC_CODEC_YUVA, width, height, 1, 1 );
+    if ( pic == NULL )
+        return NULL;
+    picture_Copy( pic, base );
+
+    uint8_t *Y = pic->p[Y_PLANE].p_pixels, *U = pic->p[U_PLANE].p_pixels;
+    uint8_t *V = pic->p[V_PLANE].p_pixels, *A = pic->p[A_PLANE].p_pixels;
+    const int pitch = pic->p[0].i_pitch;
+
+    // Remap colors: the atlas was converted with rgb_to_yuv(), so YUV values match exactly.
+    // Source colors are looked up in the base atlas, so pairs don't chain
+    const uint8_t *bY = base->p[Y_PLANE].p_pixels, *bU = base->p[U_PLANE].p_pixels;
+    const uint8_t *bV = base->p[V_PLANE].p_pixels;
+    for ( unsigned i = 0; i < style->colors; i++ )
+    {
+        uint8_t fy, fu, fv, ty, tu, tv;
+        const uint32_t from = style->color_from[i], to = style->color_to[i];
+        rgb_to_yuv( &fy, &fu, &fv, from >> 16, (from >> 8) & 0xFF, from & 0xFF );
+        rgb_to_yuv( &ty, &tu, &tv, to >> 16, (to >> 8) & 0xFF, to & 0xFF );
+        for ( int y = 0; y < height; y++ )
+        {
+            for ( int x = 0; x < width; x++ )
+            {
+                const int o = y * pitch + x;
+                if ( A[o] && bY[o] == fy && bU[o] == fu && bV[o] == fv )
+                {
+                    Y[o] = ty; U[o] = tu; V[o] = tv;
+                }
+            }
+        }
+    }
+
+    // Outline and shadow: black, under the glyph
+    if ( style->outline > 0 || style->shadow > 0 )
+    {
+        const int r = style->outline, s = style->shadow;
+
+        alpha = malloc( (size_t)width * height );
+        if ( alpha == NULL )
+        {
+            picture_Release( pic );
+            return NULL;
+        }
+        for ( int y = 0; y < height; y++ )
+            memcpy( alpha + y * width, A + y * pitch, width );
+
+        for ( int y = 0; y < ch && y < height; y++ )
+        {
+            for ( int x = 0; x < width; x++ )
+            {
+                const int cell = x - x % cw;
+                int under = 0;
+
+                // Max of the glyph alpha around (outline) and up-left (shadow)
+                for ( int dy = -r; dy <= r; dy++ )
+                {
+                    for ( int dx = -r; dx <= r; dx++ )
+                    {
+                        const int sy = y + dy, sx = x + dx;
+                        if ( dx * dx + dy * dy > r * r + r )
+                            continue;
+                        if ( r > 0 && sy >= 0 && sy < ch && sx >= cell && sx < cell + cw )
+                            under = __MAX( under, alpha[sy * width + sx] );
+                        if ( s > 0 && sy - s >= 0 && sy - s < ch && sx - s >= cell && sx - s < cell + cw )
+                            under = __MAX( under, alpha[(sy - s) * width + sx - s] );
+                    }
+                }
+
+                // Glyph over black
+                const int o = y * pitch + x;
+                const int a = A[o];
+                const int out = a + under * (255 - a) / 255;
+                if ( out > a )
+                {
+                    Y[o] = ( Y[o] * a + 16 * ( out - a ) ) / out;
+                    U[o] = ( U[o] * a + 128 * ( out - a ) ) / out;
+                    V[o] = ( V[o] * a + 128 * ( out - a ) ) / out;
+                    A[o] = out;
+                }
+            }
+        }
+        free( alpha );
+    }
+
+    if ( style->opacity < 100 )
+    {
+        for ( int y = 0; y < height; y++ )
+            for ( int x = 0; x < width; x++ )
+                A[y * pitch + x] = A[y * pitch + x] * style->opacity / 100;
+    }
+
+    return pic;
+}
+
+/*****************************************************************************
+ * StyleSelect: switches the blit kernel to the atlas of the style
+ *****************************************************************************
+ * Baked atlases are kept in MRU order, so switching back is free.
+ * Returns false if the atlas can't be made (the previous one is kept).
+ *****************************************************************************/
+static bool StyleSelect( decoder_t *decoder, const char *psz_style )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+    osd_style_t style;
+    osd_atlas_t atlas;
+    unsigned i;
+
+    StyleParse( VLC_OBJECT(decoder), psz_style, &style );
+
+    for ( i = 0; i < sys->atlas_count; i++ )
+        if ( !memcmp( &sys->atlases[i].style, &style, sizeof(style) ) )
+            break;
+
+    if ( i < sys->atlas_count )
+    {
+        atlas = sys->atlases[i];
+    }
+    else
+    {
+        atlas.style = style;
+        if ( StyleIsPlain( &style ) )
+        {
+            atlas.pic = picture_Hold( sys->p_pic_font_page_1 );
+        }
+        else
+        {
+            atlas.pic = StyleBake( sys->p_pic_font_page_1, &style );
+            if ( atlas.pic == NULL )
+            {
+                msg_Err( decoder, "StyleSelect(): cannot make atlas for style \"%s\"", psz_style );
+                return false;
+            }
+            STATS_ADD( sys->stats, alloc_bytes, picture_size( atlas.pic ) );
+            msg_Dbg( decoder, "StyleSelect(): baked atlas for style \"%s\"", psz_style );
+        }
+
+        // Least recently used atlas makes room
+        if ( sys->atlas_count == STYLE_VARIANTS )
+            picture_Release( sys->atlases[--sys->atlas_count].pic );
+        i = sys->atlas_count++;
+    }
+
+    // Move to front
+    memmove( &sys->atlases[1], &sys->atlases[0], i * sizeof(sys->atlases[0]) );
+    sys->atlases[0] = atlas;
+
+    for ( int i_plane = 0; i_plane < atlas.pic->i_planes && i_plane < OSD_BLIT_MAX_PLANES; i_plane++ )
+    {
+        sys->blit.font[i_plane].pixels = atlas.pic->p[i_plane].p_pixels;
+        sys->blit.font[i_plane].pitch = atlas.pic->p[i_plane].i_pitch;
+    }
+    return true;
+}
+
+/*****************************************************************************
+ * StyleUpdate: applies the style if it has changed
+ *****************************************************************************/
+static void StyleUpdate( decoder_t *decoder, bool b_force )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+    char *psz_style = NULL;
+    bool b_changed;
+
+    vlc_mutex_lock( &sys->font_lock );
+    b_changed = sys->b_style_changed || b_force;
+    if ( b_changed && sys->psz_style )
+        psz_style = strdup( sys->psz_style );
+    sys->b_style_changed = false;
+    vlc_mutex_unlock( &sys->font_lock );
+
+    if ( !b_changed )
+        return;
+
+    if ( StyleSelect( decoder, psz_style ) && !b_force && sys->cache )
+    {
+        // Cached canvases have the old style
+        osd_cache_Purge( sys->cache );
+    }
+    free( psz_style );
+}
+
+/*****************************************************************************
+ * StyleCallback: style changed at runtime, applied by the next Decode()
+ *****************************************************************************/
+static int StyleCallback( vlc_object_t *p_this, char const *psz_var,
+                          vlc_value_t oldval, vlc_value_t newval, void *p_data )
+{
+    VLC_UNUSED(p_this); VLC_UNUSED(psz_var); VLC_UNUSED(oldval);
+    decoder_sys_t *sys = (decoder_sys_t *)p_data;
+    char *psz_style = newval.psz_string ? strdup( newval.psz_string ) : NULL;
+
+    vlc_mutex_lock( &sys->font_lock );
+    free( sys->psz_style );
+    sys->psz_style = psz_style;
+    sys->b_style_changed = true;
+    vlc_mutex_unlock( &sys->font_lock );
+
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * FontLoad: reads the font file and converts it to the YUVA atlas
+ *****************************************************************************/
+static int FontLoad( decoder_t *decoder )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+    const size_t font_page_size = FONT_PAGE_SIZE;
+    FILE * fp = NULL;
+    picture_t *pic = NULL;
+    int rtn = VLC_SUCCESS;
+
+    sys->p_raw_font_page_1 = malloc( font_page_size );
+    if (sys->p_raw_font_page_1 == NULL) {
+    	rtn = VLC_ENOMEM;
+    	goto cleanup;
+    }
+
+    msg_Dbg( decoder, "FontLoad(): open font file \"%s\"", sys->fontpath );
+    fp = vlc_fopen( sys->fontpath, "rb" );
+    if ( fp == NULL )
+    {
+    	msg_Err( decoder, "FontLoad(): font file \"%s\" not found", sys->fontpath );
+    	rtn = VLC_EGENERIC;
+    	goto cleanup;
+    }
+    fseek( fp, 0, SEEK_END );
+    if ( (size_t)ftell(fp ) != font_page_size )
+    {
+    	msg_Err( decoder, "FontLoad(): Incorrect size of font file" );
+    	rtn = VLC_EGENERIC;
+    	goto cleanup;
+    }
+
+    fseek(fp, 0, SEEK_SET);
+
+    if ( fread( sys->p_raw_font_page_1, font_page_size, 1, fp ) != 1 )
+    {
+    	msg_Err( decoder, "FontLoad(): Error read font file" );
+    	rtn = VLC_EGENERIC;
+    	goto cleanup;
+    }
+
+    fclose( fp ); fp = NULL;
+
+    // Decode font to picture_t for optimization
+    pic = picture_New(
+    		VLC_CODEC_YUVA,
+			FONT_WIDTH * 256,
+			FONT_HEIGHT, 1, 1);
+    if ( pic == NULL )
+    {
+    	msg_Err( decoder, "FontLoad(): Error picture_New()" );
+    	rtn = VLC_EGENERIC;
+    	goto cleanup;
+    }
+
+    // Put chars to row to a picture_t
+    for ( int i_char = 0; i_char < 256; i_char++ )
+    {
+    	const int cw = FONT_WIDTH;
+    	const int ch = FONT_HEIGHT;
+    	int i_pitch = pic->p[0].i_pitch;
+    	int i_pixel_pitch = pic->p[0].i_pixel_pitch;
+    	uint8_t *font_char = sys->p_raw_font_page_1 + cw * ch * FONT_BYTES_PER_PIXEL * i_char;
+
+    	for ( int i_line = 0; i_line < ch; i_line++ )
+    	{
+    		uint32_t offset = i_pitch * i_line + i_pixel_pitch * cw * i_char;  // begin of char
+    		for ( int i = 0; i < cw; i++ )
+    		{
+    			uint8_t px[4];
+    			uint8_t *inp_px = font_char + (i_line * cw + i) * FONT_BYTES_PER_PIXEL;
+    			px[3] = inp_px[3];  // transparency
+    			rgb_to_yuv(px, px+1, px+2, inp_px[0], inp_px[1], inp_px[2]);
+    			for ( int i_plane = 0; i_plane < pic->i_planes; i_plane++ )
+    			{
+    				if ( i_plane < 4 )
+    				{
+    					pic->p[i_plane].p_pixels[offset + i_pixel_pitch * i] = px[i_plane];
+    				}
+    			}
+    		}
+    	}
+    }
+
+    // Blit kernel specialized for the font geometry
+    osd_plane_t font_planes[OSD_BLIT_MAX_PLANES];
+    for ( int i_plane = 0; i_plane < pic->i_planes && i_plane < OSD_BLIT_MAX_PLANES; i_plane++ )
+    {
+        font_planes[i_plane].pixels = pic->p[i_plane].p_pixels;
+        font_planes[i_plane].pitch = pic->p[i_plane].i_pitch;
+    }
+    osd_blit_get( &sys->blit, OSD_BLIT_YUVA, FONT_WIDTH, FONT_HEIGHT, font_planes );
 
-    es_out_id_t *es;
+    // Published to the decoder thread by FontThread() under font_lock
+    sys->p_pic_font_page_1 = pic;
+    msg_Dbg( decoder, "FontLoad(): font atlas %zu KB, %s blit", picture_size( pic ) / 1024, sys->blit.name );
 
-    size_t      current;
-    int64_t     next_date;
-    bool        b_slave;
-    bool        b_first_time;
-    double      fps;
-};
+    StyleUpdate( decoder, true );
 
-struct intf_sys_t
-{
-    vlc_mutex_t lock;
-    bool b_autoload;
-};
+cleanup:
+    if ( fp )
+    {
+        fclose( fp ); fp = NULL;
+    }
+    // Only the converted font is used for drawing
+    free( sys->p_raw_font_page_1 ); sys->p_raw_font_page_1 = NULL;
+    return rtn;
+}
 
 /*****************************************************************************
- * Local prototypes
+ * FontThread: loads the font without blocking the opening of the input
  *****************************************************************************/
-static void draw_osd_char(decoder_t *, picture_t *, int, int, uint16_t);
-static void rgb_to_yuv( uint8_t *, uint8_t *, uint8_t *, int, int, int );
-static char * uri_replace_ext(const char *, const char *);
+static void * FontThread( void *data )
+{
+    decoder_t *decoder = data;
+    decoder_sys_t *sys = decoder->p_sys;
+    int rtn = FontLoad( decoder );
+    block_t *block;
+
+    vlc_mutex_lock( &sys->font_lock );
+    sys->font_status = rtn;
+    sys->font_time = mdate();
+    sys->b_font_loading = false;
+    block = sys->b_closing ? NULL : sys->p_pending;
+    if ( block )
+        sys->p_pending = NULL;
+    vlc_mutex_unlock( &sys->font_lock );
+
+    if ( rtn == VLC_SUCCESS )
+        msg_Dbg( decoder, "FontThread(): font ready in %"PRId64" ms",
+                 ( sys->font_time - sys->open_time ) / 1000 );
+
+    // Show the frame that waited for the font now: the input may be paused.
+    // The decoder thread joins this one before decoding anything else
+    if ( block )
+        DecodeBlock( decoder, block );
+    return NULL;
+}
 
 /*****************************************************************************
  * OpenCodec:
@@ -200,19 +1125,18 @@ static char * uri_replace_ext(const char *, const char *);
 static int OpenCodec( vlc_object_t *p_this )
 {
     static const char str_path_sep[] = "/";
-    static const char str_font[] = "font";
-    static const char str_font_hd[] = "_hd";
-    static const char str_font_ext[] = ".bin";
+    static const char str_font[] = FONT_FILE_PREFIX;
+    static const char str_font_hd[] = FONT_FILE_HD;
+    static const char str_font_ext[] = FONT_FILE_EXT;
     decoder_t     *decoder = (decoder_t *) p_this;
     decoder_sys_t *sys = NULL;
-    FILE * fp = NULL;
-    size_t font_page_size;
     char * fontpath = NULL;
     char * fontfolder = NULL;
     int rtn = VLC_SUCCESS;
     int font_variant;
     size_t fontpath_size = 0;
     const file_header_t *file_hdr = NULL;
+    struct stat st;
 
     msg_Info( decoder, "OpenCodec()" );
 
@@ -221,9 +1145,10 @@ static int OpenCodec( vlc_object_t *p_this )
         return VLC_EGENERIC;
     }
 
-    if ( decoder->fmt_in.i_extra != sizeof(file_header_t) )
+    if ( decoder->fmt_in.i_extra != sizeof(file_header_t) &&
+         decoder->fmt_in.i_extra != sizeof(osd_es_extra_t) )
     {
-        msg_Err( decoder, "OpenCodec(): incorrect size of the extra. Expected %d, got %d", (int)sizeof(file_header_t), decoder->fmt_in.i_extra );
+        msg_Err( decoder, "OpenCodec(): incorrect size of the extra. Expected %d, got %d", (int)sizeof(osd_es_extra_t), decoder->fmt_in.i_extra );
         return VLC_EGENERIC;
     }
     file_hdr = (const file_header_t *)decoder->fmt_in.p_extra;
@@ -234,18 +1159,39 @@ static int OpenCodec( vlc_object_t *p_this )
         return VLC_ENOMEM;
     }
 
+    memset( &sys->stats, 0, sizeof(sys->stats) );
+    STATS_ADD( sys->stats, alloc_bytes, sizeof(*sys) + FONT_PAGE_SIZE );
+
+    sys->open_time = mdate();
+    sys->font_time = 0;
+    sys->b_first_osd = false;
+    sys->p_pending = NULL;
+    sys->b_closing = false;
+    sys->last_lookup = -1;
+    sys->b_font_thread = false;
+    sys->b_font_loading = true;
+    sys->b_font_ready = false;
+    sys->font_status = VLC_EGENERIC;
+    sys->fontpath = NULL;
+    sys->p_pic_font_page_1 = NULL;
+    sys->atlas_count = 0;
+    sys->psz_style = NULL;
+    sys->b_style_changed = false;
+    vlc_mutex_init( &sys->font_lock );
+
+    // Canvas cache of the demuxer
+    sys->cache = NULL;
+    if ( decoder->fmt_in.i_extra == sizeof(osd_es_extra_t) )
+    {
+        const osd_es_extra_t *extra = (const osd_es_extra_t *)decoder->fmt_in.p_extra;
+        if ( extra->cache_id != 0 )
+            sys->cache = osd_cache_Get( extra->cache_id );
+    }
+
     // Font
     sys->p_raw_font_page_1 = NULL;
     sys->p_raw_font_page_2 = NULL;
 
-    font_page_size = FONT_WIDTH * FONT_HEIGHT * FONT_BYTES_PER_PIXEL * 256;
-
-    sys->p_raw_font_page_1 = malloc( font_page_size );
-    if (sys->p_raw_font_page_1 == NULL) {
-    	rtn = VLC_ENOMEM;
-    	goto cleanup;
-    }
-
     // get font folder
     fontfolder = var_CreateGetStringCommand( decoder, CFG_FONT_FOLDER );
     if ( fontfolder == NULL )
@@ -283,93 +1229,49 @@ static int OpenCodec( vlc_object_t *p_this )
     strcat(fontpath, str_font_hd);
     strcat(fontpath, str_font_ext);
 
-    msg_Dbg( decoder, "OpenCodec(): open font file \"%s\"", fontpath );
-    fp = vlc_fopen( fontpath, "rb" );
-    if ( fp == NULL )
+    // The font is read by a thread, but without a font there is no OSD at
+    // all: let another decoder take the ES
+    if ( vlc_stat( fontpath, &st ) != 0 || !S_ISREG( st.st_mode ) )
     {
-    	msg_Err( decoder, "OpenCodec(): font file \"%s\" not found", fontpath );
-    	rtn = VLC_EGENERIC;
-    	goto cleanup;
-    }
-    fseek( fp, 0, SEEK_END );
-    if ( (size_t)ftell(fp ) != font_page_size )
-    {
-    	msg_Err( decoder, "OpenCodec(): Incorrect size of font file" );
-    	rtn = VLC_EGENERIC;
-    	goto cleanup;
+        msg_Err( decoder, "OpenCodec(): font file \"%s\" not found", fontpath );
+        rtn = VLC_EGENERIC;
+        goto cleanup;
     }
 
-    fseek(fp, 0, SEEK_SET);
+    free( fontfolder ); fontfolder = NULL;
+    sys->fontpath = fontpath; fontpath = NULL;
 
-    if ( fread( sys->p_raw_font_page_1, font_page_size, 1, fp ) != 1 )
-    {
-    	msg_Err( decoder, "OpenCodec(): Error read font file" );
-    	rtn = VLC_EGENERIC;
-    	goto cleanup;
-    }
+    decoder->p_sys = sys;
+    decoder->pf_decode = Decode;
+    decoder->pf_flush = Flush;
+    decoder->fmt_out.i_codec = 0;
 
-    fclose( fp ); fp = NULL;
-    free( fontfolder ); fontfolder = NULL;
-    free( fontpath ); fontpath = NULL;
+    // Style can be switched while playing. The variable is on the input,
+    // the decoder object is not reachable from the interfaces and libvlc
+    sys->psz_style = var_CreateGetStringCommand( decoder->obj.parent, CFG_STYLE );
+    var_AddCallback( decoder->obj.parent, CFG_STYLE, StyleCallback, sys );
 
-    // Decode font to picture_t for optimization
-    sys->p_pic_font_page_1 = picture_New(
-    		VLC_CODEC_YUVA,
-			FONT_WIDTH * 256,
-			FONT_HEIGHT, 1, 1);
-    if ( sys->p_pic_font_page_1 == NULL )
+    // The font may be on a slow (network) drive: don't delay the first video frame
+    if ( vlc_clone( &sys->font_thread, FontThread, decoder, VLC_THREAD_PRIORITY_LOW ) == 0 )
     {
-    	msg_Err( decoder, "OpenCodec(): Error picture_New()" );
-    	rtn = VLC_EGENERIC;
-    	goto cleanup;
+        sys->b_font_thread = true;
     }
-
-    // Put chars to row to a picture_t
-    for ( int i_char = 0; i_char < 256; i_char++ )
+    else
     {
-    	picture_t *pic = sys->p_pic_font_page_1;
-    	const int cw = FONT_WIDTH;
-    	const int ch = FONT_HEIGHT;
-    	int i_pitch = pic->p[0].i_pitch;
-    	int i_pixel_pitch = pic->p[0].i_pixel_pitch;
-    	uint8_t *font_char = sys->p_raw_font_page_1 + cw * ch * FONT_BYTES_PER_PIXEL * i_char;
-
-    	for ( int i_line = 0; i_line < ch; i_line++ )
-    	{
-    		uint32_t offset = i_pitch * i_line + i_pixel_pitch * cw * i_char;  // begin of char
-    		for ( int i = 0; i < cw; i++ )
-    		{
-    			uint8_t px[4];
-    			uint8_t *inp_px = font_char + (i_line * cw + i) * FONT_BYTES_PER_PIXEL;
-    			px[3] = inp_px[3];  // transparency
-    			rgb_to_yuv(px, px+1, px+2, inp_px[0], inp_px[1], inp_px[2]);
-    			for ( int i_plane = 0; i_plane < pic->i_planes; i_plane++ )
-    			{
-    				if ( i_plane < 4 )
-    				{
-    					pic->p[i_plane].p_pixels[offset + i_pixel_pitch * i] = px[i_plane];
-    				}
-    			}
-    		}
-    	}
+        msg_Warn( decoder, "OpenCodec(): cannot start font thread, loading synchronously" );
+        FontThread( decoder );
     }
 
-    decoder->p_sys = sys;
-    decoder->pf_decode = Decode;
-    decoder->fmt_out.i_codec = 0;
-
     return VLC_SUCCESS;
 
 cleanup:
     free( fontfolder); fontfolder = NULL;
     free( fontpath); fontpath = NULL;
-    if ( fp )
-    {
-        fclose( fp ); fp = NULL;
-    }
     if ( sys )
     {
-        free( sys->p_raw_font_page_1 ); sys->p_raw_font_page_1 = NULL;
+        if ( sys->cache )
+            osd_cache_Release( sys->cache );
+        vlc_mutex_destroy( &sys->font_lock );
         free( sys ); sys = NULL;
     }
 
@@ -389,71 +1291,160 @@ static void CloseCodec( vlc_object_t *p_this )
     if ( sys == NULL )
     	return;
 
+    var_DelCallback( decoder->obj.parent, CFG_STYLE, StyleCallback, sys );
+    var_Destroy( decoder->obj.parent, CFG_STYLE );
+    vlc_mutex_lock( &sys->font_lock );
+    sys->b_closing = true;
+    vlc_mutex_unlock( &sys->font_lock );
+    if ( sys->b_font_thread )
+        vlc_join( sys->font_thread, NULL );
+    if ( sys->p_pending )
+        block_Release( sys->p_pending );
+
+#ifndef FPVOSD_NO_STATS
+    msg_Info( decoder, "CloseCodec(): %"PRIu64" frames rendered, %"PRIu64" from cache, %"PRIu64" skipped, "
+              "%"PRIu64" glyphs, render p50 %"PRIu64" ns p99 %"PRIu64" ns, %"PRIu64" bytes allocated",
+              sys->stats.frames_decoded, sys->stats.frames_cached, sys->stats.frames_skipped,
+              sys->stats.glyphs,
+              stats_hist_percentile( &sys->stats.render_ns, 50 ),
+              stats_hist_percentile( &sys->stats.render_ns, 99 ),
+              sys->stats.alloc_bytes );
+    stats_decoder_publish( decoder, true );
+#endif
+
+    if ( sys->cache )
+    {
+        osd_cache_t *cache = sys->cache;
+        uint64_t lookups = cache->hits + cache->misses;
+        msg_Info( decoder, "CloseCodec(): canvas cache %"PRIu64" hits, %"PRIu64" misses (%.1f%%), "
+                  "%"PRIu64" reads skipped, %zu of %zu KB used",
+                  cache->hits, cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0,
+                  cache->reads_skipped, cache->used / 1024, cache->budget / 1024 );
+        osd_cache_Release( cache );
+        sys->cache = NULL;
+    }
+
+    for ( unsigned i = 0; i < sys->atlas_count; i++ )
+        picture_Release( sys->atlases[i].pic );
+    free( sys->psz_style ); sys->psz_style = NULL;
     if ( sys->p_pic_font_page_1 )
     {
     	picture_Release(sys->p_pic_font_page_1);
     	sys->p_pic_font_page_1 = NULL;
     }
 	free( sys->p_raw_font_page_1 ); sys->p_raw_font_page_1 = NULL;
+    free( sys->fontpath ); sys->fontpath = NULL;
+    vlc_mutex_destroy( &sys->font_lock );
     free( sys ); sys = NULL;
 }
 
 /*****************************************************************************
  * draw_osd_char:
  *****************************************************************************/
-static void draw_osd_char(decoder_t *decoder, picture_t *pic, int x, int y, uint16_t c) {
-	const int cw = FONT_WIDTH;
-	const int ch = FONT_HEIGHT;
-	picture_t *font_pic = decoder->p_sys->p_pic_font_page_1;
+static void draw_osd_char(decoder_t *decoder, const osd_plane_t *dst, int x, int y, uint16_t c) {
+	const osd_blit_t *blit = &decoder->p_sys->blit;
 	int yoffset = (DISPLAY_OVERLAY_HEIGHT - DISPLAY_ORIGINAL_HEIGHT) / 2;
 	int xoffset = (DISPLAY_OVERLAY_WIDTH - DISPLAY_ORIGINAL_WIDTH) / 2;
 
-	c  &= 0xFF;
-
-	for( int i_plane = 0; i_plane < pic->i_planes; i_plane++ ) {
-		int i_pitch = pic->p[i_plane].i_pitch;
-		int i_pixel_pitch = pic->p[i_plane].i_pixel_pitch;
-		int i_pitch_font = font_pic->p[i_plane].i_pitch;
-		for ( int i_line = 0; i_line < ch; i_line++ ) {
-			uint32_t offset = i_pitch * (i_line + ch * y + yoffset) + i_pixel_pitch * (x * cw + xoffset);
-			uint32_t offset_font = i_pitch_font * i_line + i_pixel_pitch * cw * c;
-			memcpy(pic->p[i_plane].p_pixels + offset,
-				   font_pic->p[i_plane].p_pixels + offset_font,
-				   i_pixel_pitch * cw);
-		}
-	}
+	blit->blit( blit, dst, x * FONT_WIDTH + xoffset, y * FONT_HEIGHT + yoffset, c & 0xFF );
 }
 
 /*****************************************************************************
- * Decode:
+ * FontJoin: the font thread has finished loading, waits for its end
  *****************************************************************************/
-static int Decode( decoder_t *decoder, block_t *block )
+static void FontJoin( decoder_t *decoder )
 {
     decoder_sys_t *sys = decoder->p_sys;
-    subpicture_t *spu = NULL;
-    video_format_t fmt;
-    subpicture_region_t *p_region;
 
-    //msg_Info(decoder, "Decode()" );
+    // Its results are visible after font_lock; it may still be rendering
+    // the frame that waited for the font
+    if ( sys->b_font_thread )
+    {
+        vlc_join( sys->font_thread, NULL );
+        sys->b_font_thread = false;
+    }
+    sys->b_font_ready = true;
 
-    if ( block == NULL ) /* No Drain */
-        return VLCDEC_SUCCESS;
+    if ( sys->font_status == VLC_SUCCESS )
+        STATS_ADD( sys->stats, alloc_bytes, picture_size( sys->p_pic_font_page_1 ) );
+    else
+        msg_Err( decoder, "Decode(): no font, OSD is disabled" );
+}
 
-    if ( block->i_flags & BLOCK_FLAG_CORRUPTED )
+/*****************************************************************************
+ * FontWait: holds back frames until the font is loaded
+ *****************************************************************************
+ * Only the latest frame is kept: it replaces the earlier ones on screen
+ * anyway, and the font thread shows it when done. Returns the block to
+ * decode, or NULL if there is nothing to do yet.
+ *****************************************************************************/
+static block_t * FontWait( decoder_t *decoder, block_t *block )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+    bool b_loading;
+
+    vlc_mutex_lock( &sys->font_lock );
+    b_loading = sys->b_font_loading;
+    if ( b_loading && block != NULL )
     {
-    	msg_Warn( decoder, "Decode(): skip corrupted block" );
-        block_Release( block );
-        return VLCDEC_SUCCESS;
+        if ( sys->p_pending )
+        {
+            block_Release( sys->p_pending );
+            STATS_ADD( sys->stats, frames_skipped, 1 );
+        }
+        sys->p_pending = block;
+    }
+    vlc_mutex_unlock( &sys->font_lock );
+
+    if ( b_loading )
+        return NULL;
+
+    FontJoin( decoder );
+
+    if ( block == NULL )
+    {
+        // Drain: show the frame that waited for the font
+        block = sys->p_pending;
+        sys->p_pending = NULL;
     }
-    VLC_UNUSED(sys);
+    else if ( sys->p_pending )
+    {
+        // Superseded by the new frame
+        block_Release( sys->p_pending );
+        sys->p_pending = NULL;
+        STATS_ADD( sys->stats, frames_skipped, 1 );
+    }
+    return block;
+}
+
+/*****************************************************************************
+ * DecodeFrame: queues the subpicture of one frame
+ *****************************************************************************
+ * p_frame is the frame record, or NULL if the demuxer found the frame in
+ * the canvas cache.
+ *****************************************************************************/
+static void DecodeFrame( decoder_t *decoder, mtime_t i_pts, const uint8_t *p_frame )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+    subpicture_t *spu = NULL;
+    video_format_t fmt;
+    subpicture_region_t *p_region;
 
-    //msg_Info(decoder, "Decode(): i_pts=%lld i_buffer=%lld i_length=%lld i_size=%lld", block->i_pts, block->i_buffer, block->i_length, block->i_size );
+    picture_t *cached = sys->cache ? osd_cache_Lookup( sys->cache, i_pts, sys->last_lookup ) : NULL;
+    sys->last_lookup = i_pts;
+    if ( cached == NULL && p_frame == NULL )
+    {
+        // Evicted after the demuxer skipped reading it
+        msg_Dbg( decoder, "Decode(): no map for frame %"PRId64, i_pts );
+        STATS_ADD( sys->stats, frames_skipped, 1 );
+        return;
+    }
 
     spu = decoder_NewSubpicture( decoder, NULL );
 	if ( spu != NULL )
 	{
-		spu->i_start = block->i_pts;
-		//spu->i_stop = block->i_pts + block->i_length;
+		spu->i_start = i_pts;
+		//spu->i_stop = i_pts + i_length;
 		// TODO: To ensure that the OSD does not disappear when paused
 		spu->i_stop = spu->i_start + CLOCK_FREQ * 1000000;
 		spu->b_ephemer = true;
@@ -480,8 +1471,11 @@ static int Decode( decoder_t *decoder, block_t *block )
 	        msg_Err( decoder, "cannot allocate SPU region" );
 	        subpicture_Delete( spu );
 	        spu = NULL;
-	        goto exit;
+	        if ( cached )
+	            picture_Release( cached );
+	        return;
 	    }
+	    STATS_ADD( sys->stats, alloc_bytes, picture_size( p_region->p_picture ) );
 		p_region->i_align = 0;
 	    p_region->i_x = 0;
 	    p_region->i_y = 0;
@@ -489,26 +1483,239 @@ static int Decode( decoder_t *decoder, block_t *block )
 	    spu->p_region = p_region;
 	    spu->i_alpha = 255;  // non-transparent
 
-	    // Draw all non-null chars
-	    uint16_t * map = (uint16_t *)(block->p_buffer + sizeof(frame_header_t));
-	    for ( int x_i = 0; x_i < MAX_X; x_i++ ) {
-	    	for ( int y_i = 0; y_i < MAX_Y; y_i++ ) {
-	    		uint16_t c = map[MAX_Y * x_i + y_i];
-	    		if ( c != 0 ) {
-	    			draw_osd_char( decoder, p_region->p_picture, x_i, y_i, c );
-	    		}
-	    	}
+	    if ( cached )
+	    {
+	    	// Rendered before: cached canvases are never modified
+	    	picture_Release( p_region->p_picture );
+	    	p_region->p_picture = cached;
+	    	STATS_ADD( sys->stats, frames_cached, 1 );
+	    }
+	    else
+	    {
+		    uint64_t render_start = stats_now_ns();
+		    unsigned glyphs = 0;
+		    osd_plane_t dst[OSD_BLIT_MAX_PLANES];
+
+		    for ( int i_plane = 0; i_plane < p_region->p_picture->i_planes && i_plane < OSD_BLIT_MAX_PLANES; i_plane++ )
+		    {
+		    	dst[i_plane].pixels = p_region->p_picture->p[i_plane].p_pixels;
+		    	dst[i_plane].pitch = p_region->p_picture->p[i_plane].i_pitch;
+		    }
+
+		    // Draw all non-null chars
+		    const uint16_t * map = (const uint16_t *)(p_frame + sizeof(frame_header_t));
+		    for ( int x_i = 0; x_i < MAX_X; x_i++ ) {
+		    	for ( int y_i = 0; y_i < MAX_Y; y_i++ ) {
+		    		uint16_t c = map[MAX_Y * x_i + y_i];
+		    		if ( c != 0 ) {
+		    			draw_osd_char( decoder, dst, x_i, y_i, c );
+		    			glyphs++;
+		    		}
+		    	}
+		    }
+		    VLC_UNUSED( render_start ); VLC_UNUSED( glyphs );
+		    stats_hist_add( &sys->stats.render_ns, stats_now_ns() - render_start );
+		    STATS_ADD( sys->stats, frames_decoded, 1 );
+		    STATS_ADD( sys->stats, glyphs, glyphs );
+		    if ( sys->cache )
+		    	osd_cache_Put( sys->cache, i_pts, p_region->p_picture );
 	    }
+		if ( !sys->b_first_osd )
+		{
+			sys->b_first_osd = true;
+			msg_Info( decoder, "Decode(): first OSD %"PRId64" ms after open (font ready after %"PRId64" ms)",
+			          ( mdate() - sys->open_time ) / 1000, ( sys->font_time - sys->open_time ) / 1000 );
+		}
 		decoder_QueueSub( decoder, spu );
 	} else {
 		msg_Err( decoder, "Decode(): spu=NULL" );
+		if ( cached )
+			picture_Release( cached );
 	}
+}
 
-exit:
-    block_Release( block );
+/*****************************************************************************
+ * DecodeBatch: queues the subpictures of all frames of a batch block
+ *****************************************************************************/
+static void DecodeBatch( decoder_t *decoder, const block_t *block )
+{
+    const uint8_t *p = block->p_buffer;
+    const uint8_t *end = block->p_buffer + block->i_buffer;
+    uint32_t count;
+
+    if ( block->i_buffer < sizeof(count) )
+        return;
+    memcpy( &count, p, sizeof(count) );
+    p += sizeof(count);
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        osd_batch_entry_t entry;
+
+        if ( (size_t)(end - p) < sizeof(entry) )
+            break;
+        memcpy( &entry, p, sizeof(entry) );
+        p += sizeof(entry);
+        if ( (size_t)(end - p) < entry.size )
+            break;
+
+        DecodeFrame( decoder, entry.pts, entry.size >= OSD_FRAME_SIZE ? p : NULL );
+        p += entry.size;
+    }
+}
+
+/*****************************************************************************
+ * Flush: drops the frame waiting for the font, the next lookups start over
+ *****************************************************************************/
+static void Flush( decoder_t *decoder )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+    bool b_loading;
+
+    vlc_mutex_lock( &sys->font_lock );
+    if ( sys->p_pending )
+    {
+        block_Release( sys->p_pending );
+        sys->p_pending = NULL;
+    }
+    b_loading = sys->b_font_loading;
+    vlc_mutex_unlock( &sys->font_lock );
+
+    // The font thread may be rendering
+    if ( !sys->b_font_ready && !b_loading )
+        FontJoin( decoder );
+    sys->last_lookup = -1;
+}
+
+/*****************************************************************************
+ * Decode:
+ *****************************************************************************/
+static int Decode( decoder_t *decoder, block_t *block )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+
+    //msg_Info(decoder, "Decode()" );
+
+    if ( !sys->b_font_ready )
+    {
+        block = FontWait( decoder, block );
+        if ( block == NULL )
+            return VLCDEC_SUCCESS;
+    }
+
+    if ( block == NULL ) /* No Drain */
+        return VLCDEC_SUCCESS;
+
+    DecodeBlock( decoder, block );
     return VLCDEC_SUCCESS;
 }
 
+/*****************************************************************************
+ * DecodeBlock: renders a block of the demuxer and releases it
+ *****************************************************************************/
+static void DecodeBlock( decoder_t *decoder, block_t *block )
+{
+    decoder_sys_t *sys = decoder->p_sys;
+
+    if ( sys->font_status != VLC_SUCCESS )
+    {
+        STATS_ADD( sys->stats, frames_skipped, 1 );
+        block_Release( block );
+        return;
+    }
+
+    StyleUpdate( decoder, false );
+
+    if ( block->i_flags & BLOCK_FLAG_CORRUPTED )
+    {
+    	msg_Warn( decoder, "Decode(): skip corrupted block" );
+    	STATS_ADD( sys->stats, frames_skipped, 1 );
+        block_Release( block );
+        return;
+    }
+
+    if ( block->i_flags & BLOCK_FLAG_OSD_BATCH )
+        DecodeBatch( decoder, block );
+    else
+        DecodeFrame( decoder, block->i_pts,
+                     ( block->i_flags & BLOCK_FLAG_OSD_CACHED ) || block->i_buffer < OSD_FRAME_SIZE ?
+                     NULL : block->p_buffer );
+
+    stats_decoder_publish( decoder, false );
+    block_Release( block );
+}
+
+/*****************************************************************************
+ * IndexGet: returns entry i of the plain or run-length encoded index
+ *****************************************************************************/
+static osd_entry_t IndexGet( const demux_sys_t *sys, size_t i )
+{
+    const osd_run_t *run;
+    osd_entry_t e;
+    size_t lo = 0, hi = sys->run_count;
+
+    if ( sys->index )
+        return sys->index[i];
+
+    // last run with first <= i
+    while ( hi - lo > 1 )
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if ( sys->runs[mid].first <= i )
+            lo = mid;
+        else
+            hi = mid;
+    }
+    run = &sys->runs[lo];
+    e.frame_idx = run->frame_idx + run->step * (uint32_t)(i - run->first);
+    e.block = run->block + (uint32_t)(i - run->first);
+    return e;
+}
+
+static unsigned IndexChunkOf( const demux_sys_t *sys, uint32_t block )
+{
+    unsigned c = sys->chunk_count - 1;
+    while ( c > 0 && sys->chunks[c].first_block > block )
+        c--;
+    return c;
+}
+
+static mtime_t IndexStart( const demux_sys_t *sys, size_t i )
+{
+    osd_entry_t e = IndexGet( sys, i );
+    return sys->chunks[IndexChunkOf( sys, e.block )].offset + e.frame_idx * CLOCK_FREQ / sys->fps;
+}
+
+static mtime_t IndexStop( const demux_sys_t *sys, size_t i )
+{
+    if ( i + 1 < sys->count )
+        return IndexStart( sys, i + 1 );
+    return IndexStart( sys, i ) + CLOCK_FREQ / 10;
+}
+
+static size_t IndexSize( const demux_sys_t *sys )
+{
+    return sys->index ? sys->count * sizeof(*sys->index) : sys->run_count * sizeof(*sys->runs);
+}
+
+/*****************************************************************************
+ * IndexFind: returns the entry to start from for time t, count if none
+ *****************************************************************************/
+static size_t IndexFind( demux_sys_t *sys, mtime_t t )
+{
+    // first entry i >= 1 with start >= t
+    size_t lo = 1, hi = sys->count;
+    while ( lo < hi )
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if ( IndexStart( sys, mid ) >= t )
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo < sys->count ? lo - 1 : sys->count;
+}
+
 /*****************************************************************************
  * ControlDemux:
  *****************************************************************************/
@@ -526,7 +1733,7 @@ static int ControlDemux(demux_t *demux, int query, va_list args)
     case DEMUX_GET_LENGTH: {
         int64_t *l = va_arg( args, int64_t * );
         //msg_Dbg( demux, "ControlDemux(DEMUX_GET_LENGTH, %lld)", l );
-        *l = sys->count > 0 ? sys->index[sys->count-1].stop : 0;
+        *l = sys->length;
         return VLC_SUCCESS;
     }
     case DEMUX_GET_TIME: {
@@ -546,16 +1753,17 @@ static int ControlDemux(demux_t *demux, int query, va_list args)
     case DEMUX_SET_TIME: {
         int64_t t = va_arg( args, int64_t );
         //msg_Dbg( demux, "ControlDemux(DEMUX_SET_TIME, %lld)", t );
-        for ( size_t i = 0; i + 1 < sys->count; i++ )
+        // Demux() seeks the stream of the chunk holding the entry
+        size_t i = IndexFind( sys, t );
+        if ( i < sys->count )
         {
-            if ( sys->index[i + 1].start >= t &&
-                vlc_stream_Seek( demux->s, 1024 + 128LL * sys->index[i].blocknumber ) == VLC_SUCCESS )
-            {
-                sys->current = i;
-                sys->next_date = t;
-                sys->b_first_time = true;
-                return VLC_SUCCESS;
-            }
+            sys->current = i;
+            sys->next_date = t;
+            sys->b_first_time = true;
+            sys->last_sent = -1;
+            if ( sys->cache )
+                osd_cache_Unpin( sys->cache );
+            return VLC_SUCCESS;
         }
         break;
     }
@@ -563,9 +1771,9 @@ static int ControlDemux(demux_t *demux, int query, va_list args)
     {
         double f = va_arg( args, double );
         //msg_Info( demux, "ControlDemux(DEMUX_SET_POSITION, %f)", f );
-        if (sys->count && sys->index[sys->count-1].stop > 0)
+        if ( sys->length > 0 )
         {
-            int64_t i64 = f * sys->index[sys->count-1].stop;
+            int64_t i64 = f * sys->length;
             return demux_Control( demux, DEMUX_SET_TIME, i64 );
         }
         break;
@@ -577,12 +1785,12 @@ static int ControlDemux(demux_t *demux, int query, va_list args)
         {
             *pf = 1.0;
         }
-        else if ( sys->count > 0 && sys->index[sys->count-1].stop > 0 )
+        else if ( sys->length > 0 )
         {
             *pf = sys->next_date - var_GetInteger( demux->obj.parent, "spu-delay" );
             if (*pf < 0)
                *pf = sys->next_date;
-            *pf /= sys->index[sys->count-1].stop;
+            *pf /= sys->length;
         }
         else
         {
@@ -598,13 +1806,47 @@ static int ControlDemux(demux_t *demux, int query, va_list args)
     return VLC_EGENERIC;
 }
 
+/*****************************************************************************
+ * DemuxSeek: positions the stream of the chunk holding entry e
+ *****************************************************************************/
+static stream_t * DemuxSeek( demux_sys_t *sys, osd_entry_t e )
+{
+    const unsigned chunk = IndexChunkOf( sys, e.block );
+    stream_t *stream = sys->chunks[chunk].s;
+    const uint64_t i_pos = sizeof(file_header_t) +
+            OSD_FRAME_SIZE * (uint64_t)(e.block - sys->chunks[chunk].first_block);
+
+    if ( i_pos != vlc_stream_Tell( stream ) &&
+            vlc_stream_Seek( stream, i_pos ) != VLC_SUCCESS )
+        return NULL;
+    return stream;
+}
+
+/*****************************************************************************
+ * DemuxBatchSend: sends the frames collected in the batch block
+ *****************************************************************************/
+static void DemuxBatchSend( demux_t *demux, block_t *batch, uint32_t count, mtime_t stop )
+{
+    demux_sys_t *sys = demux->p_sys;
+
+    memcpy( batch->p_buffer, &count, sizeof(count) );
+    batch->i_flags |= BLOCK_FLAG_OSD_BATCH;
+    if ( stop > batch->i_pts )
+        batch->i_length = stop - batch->i_pts;
+    STATS_ADD( sys->stats, blocks_sent, 1 );
+    es_out_Send( demux->out, sys->es, batch );
+}
+
 /*****************************************************************************
  * Demux:
  *****************************************************************************/
 static int Demux(demux_t *demux)
 {
-	const size_t frame_size = MAX_X * MAX_Y * sizeof(uint16_t) + sizeof(frame_header_t);
+	const size_t frame_size = OSD_FRAME_SIZE;
     demux_sys_t *sys = demux->p_sys;
+    block_t *batch = NULL;
+    uint32_t batch_count = 0;
+    mtime_t batch_stop = 0;
 
     //msg_Dbg( demux, "Demux()" );
 
@@ -613,10 +1855,27 @@ static int Demux(demux_t *demux)
     if (i_barrier < 0)
         i_barrier = sys->next_date;
 
-    while ( sys->current < sys->count &&
-          sys->index[sys->current].start <= i_barrier )
+    // On fast playback the vout shows at most one frame per video frame interval
+    mtime_t i_interval = 0;
+    if ( sys->b_decimate )
     {
-        osd_entry_t *s = &sys->index[sys->current];
+        float f_rate = var_GetFloat( demux->obj.parent, "rate" );
+        if ( f_rate > 1.f )
+            i_interval = CLOCK_FREQ * f_rate / sys->fps;
+    }
+
+    while ( sys->current < sys->count )
+    {
+        const osd_entry_t e = IndexGet( sys, sys->current );
+        const mtime_t start = IndexStart( sys, sys->current );
+        const mtime_t stop = IndexStop( sys, sys->current );
+
+        // An open batch takes the following frames ahead of the barrier
+        const mtime_t i_horizon = batch ?
+                __MAX( i_barrier, batch->i_pts - VLC_TS_0 + BATCH_LOOKAHEAD ) : i_barrier;
+
+        if ( start > i_horizon )
+            break;
 
         if ( !sys->b_slave && sys->b_first_time )
         {
@@ -624,19 +1883,103 @@ static int Demux(demux_t *demux)
             sys->b_first_time = false;
         }
 
-        const uint64_t i_pos = 18 + frame_size * s->blocknumber;
-        if ( i_pos != vlc_stream_Tell( demux->s ) &&
-        		vlc_stream_Seek( demux->s, i_pos ) != VLC_SUCCESS )
+        // Skip the frame without reading it if the next one is due now and
+        // is still within the interval of the last sent frame
+        if ( i_interval > 0 && sys->last_sent >= 0 && sys->current + 1 < sys->count )
+        {
+            const mtime_t next = IndexStart( sys, sys->current + 1 );
+            if ( next <= i_horizon && next - sys->last_sent < i_interval )
+            {
+                STATS_ADD( sys->stats, blocks_decimated, 1 );
+                sys->current++;
+                continue;
+            }
+        }
+        sys->last_sent = start;
+
+        const bool b_cached = sys->cache && osd_cache_Touch( sys->cache, VLC_TS_0 + start );
+
+        if ( sys->batch > 1 )
+        {
+            osd_batch_entry_t entry;
+
+            if ( batch == NULL )
+            {
+                batch = block_Alloc( sizeof(uint32_t) +
+                                     sys->batch * ( sizeof(entry) + frame_size ) );
+                if ( batch == NULL )
+                    return VLC_DEMUXER_EOF;
+                batch->i_buffer = sizeof(uint32_t);
+                batch->i_dts =
+                batch->i_pts = VLC_TS_0 + start;
+            }
+
+            // Rendered canvas is cached: the entry has no data
+            entry.pts = VLC_TS_0 + start;
+            entry.size = b_cached ? 0 : frame_size;
+            memcpy( batch->p_buffer + batch->i_buffer, &entry, sizeof(entry) );
+
+            if ( !b_cached )
+            {
+                stream_t *stream = DemuxSeek( sys, e );
+                uint8_t *p_frame = batch->p_buffer + batch->i_buffer + sizeof(entry);
+                if ( stream == NULL ||
+                     vlc_stream_Read( stream, p_frame, frame_size ) != (ssize_t)frame_size )
+                {
+                    if ( batch_count > 0 )
+                        DemuxBatchSend( demux, batch, batch_count, batch_stop );
+                    else
+                        block_Release( batch );
+                    return VLC_DEMUXER_EOF;
+                }
+                STATS_ADD( sys->stats, bytes_read, frame_size );
+            }
+            batch->i_buffer += sizeof(entry) + entry.size;
+            batch_stop = VLC_TS_0 + stop;
+            sys->current++;
+
+            if ( ++batch_count == sys->batch )
+            {
+                DemuxBatchSend( demux, batch, batch_count, batch_stop );
+                batch = NULL;
+                batch_count = 0;
+            }
+            continue;
+        }
+
+        if ( b_cached )
+        {
+            // Rendered canvas is cached: send the timestamps only
+            block_t *b = block_Alloc( sizeof(frame_header_t) );
+            if ( b )
+            {
+                memset( b->p_buffer, 0, b->i_buffer );
+                b->i_flags |= BLOCK_FLAG_OSD_CACHED;
+                STATS_ADD( sys->stats, blocks_sent, 1 );
+                b->i_dts =
+                b->i_pts = VLC_TS_0 + start;
+                if ( stop > start )
+                    b->i_length = stop - start;
+                es_out_Send(demux->out, sys->es, b);
+            }
+            sys->current++;
+            continue;
+        }
+
+        stream_t *stream = DemuxSeek( sys, e );
+        if ( stream == NULL )
             return VLC_DEMUXER_EOF;
 
-        block_t *b = vlc_stream_Block( demux->s, frame_size );
+        block_t *b = vlc_stream_Block( stream, frame_size );
         if ( b && b->i_buffer == frame_size )
         {
             b->i_dts =
-            b->i_pts = VLC_TS_0 + s->start;
-            if ( s->stop > s->start )
-                b->i_length = s->stop - s->start;
-            //msg_Info( demux, "Demux() i_start = %lld", s->start );
+            b->i_pts = VLC_TS_0 + start;
+            if ( stop > start )
+                b->i_length = stop - start;
+            //msg_Info( demux, "Demux() i_start = %lld", start );
+            STATS_ADD( sys->stats, bytes_read, b->i_buffer );
+            STATS_ADD( sys->stats, blocks_sent, 1 );
             es_out_Send(demux->out, sys->es, b);
         }
         else
@@ -648,6 +1991,9 @@ static int Demux(demux_t *demux)
         sys->current++;
     }
 
+    if ( batch )
+        DemuxBatchSend( demux, batch, batch_count, batch_stop );
+
     if ( !sys->b_slave )
     {
         es_out_SetPCR( demux->out, VLC_TS_0 + i_barrier );
@@ -655,22 +2001,231 @@ static int Demux(demux_t *demux)
         //msg_Info( demux, "Demux() sys->next_date=%lld i_barrier=%lld", sys->next_date, i_barrier );
     }
 
+    stats_demux_publish( demux, false );
+
     return sys->current < sys->count ? VLC_DEMUXER_SUCCESS : VLC_DEMUXER_EOF;
 }
 
+/*****************************************************************************
+ * IndexChunk: appends frames of a chunk to the index
+ *****************************************************************************/
+static int IndexChunk( demux_t *demux, unsigned chunk )
+{
+	const size_t frame_size = OSD_MAP_SIZE;
+    demux_sys_t *sys = demux->p_sys;
+    stream_t *s = sys->chunks[chunk].s;
+    const uint32_t first_block = sys->chunks[chunk].first_block;
+    size_t frame_count;
+    uint64_t size;
+    osd_entry_t *index;
+
+	if ( vlc_stream_GetSize( s, &size ) != VLC_SUCCESS )
+	{
+		msg_Err( demux, "OpenDemux(): Error retrieve stream size" );
+		return VLC_EGENERIC;
+	}
+	if ( size <= sizeof(file_header_t) )
+		return VLC_SUCCESS;
+	frame_count = (size - sizeof(file_header_t)) / OSD_FRAME_SIZE;
+	if ( frame_count == 0 )
+		return VLC_SUCCESS;
+
+    index = realloc( sys->index, (sys->count + frame_count) * sizeof(*sys->index) );
+    if ( !index )
+        return VLC_ENOMEM;
+    sys->index = index;
+    STATS_ADD( sys->stats, alloc_bytes, frame_count * sizeof(*sys->index) );
+
+    for ( size_t i = 0; i < frame_count; i++ )
+    {
+    	frame_header_t hdr;
+    	uint8_t frame_data[frame_size];
+    	if ( vlc_stream_Read( s, &hdr, sizeof(hdr) ) != sizeof(hdr) ) {
+    		msg_Warn(demux, "OpenDemux(): Incomplete OSD file");
+    		break;
+    	}
+    	if ( vlc_stream_Read( s, frame_data, frame_size ) != (ssize_t)frame_size ) {
+    		msg_Warn(demux, "OpenDemux(): Incomplete OSD file");
+    		break;
+    	}
+    	STATS_ADD( sys->stats, bytes_read, sizeof(hdr) + frame_size );
+    	//msg_Info( demux, "OpenDemux(): #%llu hdr.frame_idx=%u hdr.size=%u", i, hdr.frame_idx, hdr.size );
+    	sys->index[sys->count].frame_idx = hdr.frame_idx;
+    	sys->index[sys->count].block = first_block + i;
+    	sys->count++;
+    	sys->blocks = first_block + i + 1;
+    }
+
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * IndexBuildRuns: splits the index in runs, returns their number
+ *****************************************************************************/
+static size_t IndexBuildRuns( const demux_sys_t *sys, osd_run_t *runs )
+{
+    const osd_entry_t *index = sys->index;
+    size_t n = 0;
+
+    for ( size_t i = 0; i < sys->count; )
+    {
+        osd_run_t run = { .first = i, .frame_idx = index[i].frame_idx,
+                          .block = index[i].block, .step = 0 };
+        size_t j = i + 1;
+
+        if ( j < sys->count && index[j].block == index[i].block + 1 &&
+             index[j].frame_idx >= index[i].frame_idx )
+        {
+            run.step = index[j].frame_idx - index[i].frame_idx;
+            for ( j++; j < sys->count; j++ )
+            {
+                if ( index[j].block != index[j - 1].block + 1 ||
+                     index[j].frame_idx < index[j - 1].frame_idx ||
+                     index[j].frame_idx - index[j - 1].frame_idx != run.step )
+                    break;
+            }
+        }
+
+        if ( runs )
+            runs[n] = run;
+        n++;
+        i = j;
+    }
+    return n;
+}
+
+/*****************************************************************************
+ * IndexEncode: run-length encodes the index if it becomes smaller
+ *****************************************************************************/
+static void IndexEncode( demux_t *demux )
+{
+    demux_sys_t *sys = demux->p_sys;
+    size_t run_count = IndexBuildRuns( sys, NULL );
+
+    if ( run_count * sizeof(osd_run_t) >= sys->count * sizeof(osd_entry_t) )
+    {
+        msg_Dbg( demux, "OpenDemux(): %zu runs for %zu frames, keep plain index", run_count, sys->count );
+        return;
+    }
+
+    sys->runs = malloc( run_count * sizeof(*sys->runs) );
+    if ( sys->runs == NULL )
+        return;
+    STATS_ADD( sys->stats, alloc_bytes, run_count * sizeof(*sys->runs) );
+    sys->run_count = IndexBuildRuns( sys, sys->runs );
+    free( sys->index );
+    sys->index = NULL;
+}
+
+/*****************************************************************************
+ * ChunkIsOpened: true if the chunk is the file opened by the demuxer
+ *****************************************************************************/
+static bool ChunkIsOpened( demux_t *demux, const char *item, const char *uri )
+{
+    if ( demux->s->psz_url && !strcmp( demux->s->psz_url, uri ) )
+        return true;
+#ifndef _WIN32
+    struct stat st_item, st_file;
+    if ( demux->psz_file && !strstr( item, "://" ) &&
+         vlc_stat( item, &st_item ) == 0 && vlc_stat( demux->psz_file, &st_file ) == 0 &&
+         st_item.st_dev == st_file.st_dev && st_item.st_ino == st_file.st_ino )
+        return true;
+#endif
+    return false;
+}
+
+/*****************************************************************************
+ * OpenChunks: opens and indexes further files of a split recording
+ *****************************************************************************
+ * The chunks are an option of the input item, never saved: they only belong
+ * to the recording they were given for.
+ *****************************************************************************/
+static void OpenChunks( demux_t *demux, const file_header_t *file_hdr )
+{
+    demux_sys_t *sys = demux->p_sys;
+    char *list = var_CreateGetString( demux, CFG_CHUNKS );
+    char *item, *saveptr = NULL;
+
+    if ( list == NULL )
+        return;
+
+    for ( item = strtok_r( list, "|", &saveptr ); item != NULL;
+          item = strtok_r( NULL, "|", &saveptr ) )
+    {
+        file_header_t hdr;
+        osd_chunk_t *chunks;
+        stream_t *s;
+        char *uri;
+
+        uri = strstr( item, "://" ) ? strdup( item ) : vlc_path2uri( item, NULL );
+        if ( uri == NULL )
+            continue;
+        if ( ChunkIsOpened( demux, item, uri ) )
+        {
+            msg_Warn( demux, "OpenDemux(): chunk \"%s\" is the opened file", item );
+            free( uri );
+            continue;
+        }
+        s = vlc_stream_NewURL( demux, uri );
+        free( uri );
+        if ( s == NULL )
+        {
+            msg_Warn( demux, "OpenDemux(): cannot open chunk \"%s\"", item );
+            continue;
+        }
+
+        // Chunks of one recording have identical headers
+        if ( vlc_stream_Read( s, &hdr, sizeof(hdr) ) != sizeof(hdr) ||
+             memcmp( &hdr, file_hdr, sizeof(hdr) ) )
+        {
+            msg_Warn( demux, "OpenDemux(): chunk \"%s\" doesn't match the opened file", item );
+            vlc_stream_Delete( s );
+            continue;
+        }
+
+        chunks = realloc( sys->chunks, (sys->chunk_count + 1) * sizeof(*sys->chunks) );
+        if ( chunks == NULL )
+        {
+            vlc_stream_Delete( s );
+            break;
+        }
+        sys->chunks = chunks;
+
+        // Next chunk begins one frame after the last frame. Its frame_idx
+        // may start from 0 or continue the previous chunk
+        const size_t first = sys->count;
+        const mtime_t start = first > 0 ?
+                IndexStart( sys, first - 1 ) + CLOCK_FREQ / sys->fps : 0;
+        sys->chunks[sys->chunk_count].s = s;
+        sys->chunks[sys->chunk_count].offset = start;
+        sys->chunks[sys->chunk_count].first_block = sys->blocks;
+        sys->chunk_count++;
+
+        if ( IndexChunk( demux, sys->chunk_count - 1 ) != VLC_SUCCESS )
+            break;
+        if ( sys->count > first )
+            sys->chunks[sys->chunk_count - 1].offset =
+                    start - IndexGet( sys, first ).frame_idx * CLOCK_FREQ / sys->fps;
+        msg_Dbg( demux, "OpenDemux(): chunk #%u \"%s\": %zu frames total",
+                 sys->chunk_count - 1, item, sys->count );
+    }
+
+    free( list );
+}
+
 /*****************************************************************************
  * OpenDemux:
  *****************************************************************************/
 static int OpenDemux(vlc_object_t *object)
 {
-	const size_t frame_size = MAX_X * MAX_Y * sizeof(uint16_t);
     demux_t *demux = (demux_t*)object;
     double fps; // TODO: Get from video
-    size_t frame_count;
-    uint64_t size;
-    file_header_t file_hdr, *p_file_hdr = NULL;
+    file_header_t *p_file_hdr = NULL;
+    osd_es_extra_t extra;
     demux_sys_t *sys = NULL;
     es_format_t fmt;
+    size_t cache_size, budget, used;
+    bool b_low_memory;
 
     msg_Dbg( demux, "OpenDemux(): filepath=%s name=%s file=%s", demux->s->psz_filepath, demux->s->psz_name, demux->psz_file );
 
@@ -703,14 +2258,7 @@ static int OpenDemux(vlc_object_t *object)
 
     msg_Dbg( demux, "OpenDemux(): valid OSD file!" );
 
-	if ( vlc_stream_GetSize( demux->s, &size ) != VLC_SUCCESS )
-	{
-		msg_Err( demux, "OpenDemux(): Error retrieve stream size" );
-		return VLC_EGENERIC;
-	}
-	frame_count = (size - sizeof(file_header_t)) / (sizeof(frame_header_t) + frame_size);
-
-    if ( vlc_stream_Read( demux->s, &file_hdr, sizeof(file_header_t) ) != sizeof(file_header_t) )
+    if ( vlc_stream_Read( demux->s, &extra.header, sizeof(file_header_t) ) != sizeof(file_header_t) )
     {
         msg_Err( demux, "OpenDemux(): Incomplete MSPOSD header" );
         return VLC_EGENERIC;
@@ -720,50 +2268,85 @@ static int OpenDemux(vlc_object_t *object)
     if ( !sys )
         return VLC_EGENERIC;
 
+    memset( &sys->stats, 0, sizeof(sys->stats) );
+    STATS_ADD( sys->stats, alloc_bytes, sizeof(*sys) );
     sys->b_slave   = false;
     sys->b_first_time = true;
     sys->next_date = 0;
+    sys->last_sent = -1;
     sys->current   = 0;
     sys->count     = 0;
-    sys->index     = calloc( frame_count, sizeof(*sys->index) );
-    if ( !sys->index )
+    sys->index     = NULL;
+    sys->runs      = NULL;
+    sys->run_count = 0;
+    sys->blocks    = 0;
+    sys->length    = 0;
+    sys->fps       = fps;
+    sys->b_decimate = var_CreateGetBoolCommand( demux, CFG_DECIMATE );
+    sys->batch = VLC_CLIP( var_CreateGetIntegerCommand( demux, CFG_BATCH ), 1, 64 );
+    sys->cache     = NULL;
+    sys->chunk_count = 1;
+    sys->chunks    = malloc( sizeof(*sys->chunks) );
+    demux->p_sys = sys;
+    if ( !sys->chunks )
     {
-        free(sys);
+        free( sys );
         return VLC_EGENERIC;
     }
+    sys->chunks[0].s = demux->s;
+    sys->chunks[0].offset = 0;
+    sys->chunks[0].first_block = 0;
 
-    for ( size_t i = 0; i < frame_count; i++ )
-    {
-    	frame_header_t hdr;
-    	uint8_t frame_data[frame_size];
-    	if ( vlc_stream_Read( demux->s, &hdr, sizeof(hdr) ) != sizeof(hdr) ) {
-    		msg_Warn(demux, "OpenDemux(): Incomplete OSD file");
-    		break;
-    	}
-    	if ( vlc_stream_Read( demux->s, frame_data, frame_size ) != frame_size ) {
-    		msg_Warn(demux, "OpenDemux(): Incomplete OSD file");
-    		break;
-    	}
-    	//msg_Info( demux, "OpenDemux(): #%llu hdr.frame_idx=%u hdr.size=%u", i, hdr.frame_idx, hdr.size );
-    	sys->index[sys->count].start = hdr.frame_idx * CLOCK_FREQ / fps;
-    	sys->index[sys->count].stop = sys->index[sys->count].start + CLOCK_FREQ / 10;
-    	sys->index[sys->count].blocknumber = i;
-    	if (sys->count >= 1) {
-    		sys->index[sys->count - 1].stop = sys->index[sys->count].start;
-    	}
-    	sys->count++;
-    }
+	mtime_t index_start = mdate();
+	if ( IndexChunk( demux, 0 ) != VLC_SUCCESS )
+	{
+		CloseDemux( object );
+		return VLC_EGENERIC;
+	}
+	OpenChunks( demux, &extra.header );
+	STATS_ADD( sys->stats, index_time, mdate() - index_start );
+	VLC_UNUSED( index_start );
 
-	demux->p_sys = sys;
 	if ( sys->count == 0 )
 	{
 		CloseDemux( object );
 		return VLC_EGENERIC;
 	}
+	sys->length = IndexStop( sys, sys->count - 1 );
+
+    // Memory: index first, the canvas cache gets what is left of the budget
+    b_low_memory = var_CreateGetBoolCommand( demux, CFG_LOW_MEMORY );
+    budget = (size_t)var_CreateGetIntegerCommand( demux, CFG_MEM_BUDGET ) * 1024;
+    if ( b_low_memory || ( budget > 0 && IndexSize( sys ) > budget ) )
+        IndexEncode( demux );
+    else
+    {
+        // Drop the space of frames missing in incomplete files
+        osd_entry_t *index = realloc( sys->index, sys->count * sizeof(*sys->index) );
+        if ( index )
+            sys->index = index;
+    }
+    used = sizeof(*sys) + sys->chunk_count * sizeof(*sys->chunks) + IndexSize( sys );
+    STATS_ADD( sys->stats, index_bytes, IndexSize( sys ) );
+
+    cache_size = (size_t)var_CreateGetIntegerCommand( demux, CFG_CACHE_SIZE ) * 1024 * 1024;
+    if ( budget > 0 )
+        cache_size = __MIN( cache_size, budget > used ? budget - used : 0 );
+    else if ( b_low_memory )
+        cache_size = 0;
+    if ( cache_size > 0 )
+        sys->cache = osd_cache_New( cache_size );
+    extra.cache_id = sys->cache ? sys->cache->id : 0;
+
+    msg_Info( demux, "OpenDemux(): %zu frames, index %zu KB (%s), canvas cache %zu KB, memory %zu KB, budget %zu KB",
+              sys->count, IndexSize( sys ) / 1024, sys->index ? "plain" : "run-length",
+              cache_size / 1024, (used + cache_size) / 1024, budget / 1024 );
+    if ( budget > 0 && used > budget )
+        msg_Warn( demux, "OpenDemux(): index exceeds memory budget %zu KB", budget / 1024 );
 
     es_format_Init( &fmt, SPU_ES, FOURCC_CODE );
-    fmt.i_extra = sizeof(file_header_t);
-    fmt.p_extra = &file_hdr;
+    fmt.i_extra = sizeof(extra);
+    fmt.p_extra = &extra;
 
     sys->es = es_out_Add( demux->out, &fmt );
     fmt.i_extra = 0;
@@ -792,21 +2375,25 @@ static void CloseDemux(vlc_object_t *object)
 
     msg_Dbg( demux, "CloseDemux()" );
 
+#ifndef FPVOSD_NO_STATS
+    msg_Info( demux, "CloseDemux(): index of %zu frames built in %"PRId64" us, %"PRIu64" bytes read, "
+              "%"PRIu64" blocks sent, %"PRIu64" skipped on fast playback, %"PRIu64" bytes allocated",
+              sys->count, sys->stats.index_time, sys->stats.bytes_read,
+              sys->stats.blocks_sent, sys->stats.blocks_decimated, sys->stats.alloc_bytes );
+    stats_demux_publish( demux, true );
+#endif
+
+    // chunks[0] is demux->s owned by the core
+    for ( unsigned i = 1; i < sys->chunk_count; i++ )
+        vlc_stream_Delete( sys->chunks[i].s );
+    if ( sys->cache )
+        osd_cache_Release( sys->cache );
+    free( sys->chunks );
+    free( sys->runs );
     free( sys->index );
     free( sys );
 }
 
-/*****************************************************************************
- * rgb_to_yuv:
- *****************************************************************************/
-static void rgb_to_yuv( uint8_t *y, uint8_t *u, uint8_t *v,
-                               int r, int g, int b )
-{
-    *y = ( ( (  66 * r + 129 * g +  25 * b + 128 ) >> 8 ) + 16 );
-    *u =   ( ( -38 * r -  74 * g + 112 * b + 128 ) >> 8 ) + 128 ;
-    *v =   ( ( 112 * r -  94 * g -  18 * b + 128 ) >> 8 ) + 128 ;
-}
-
 /*****************************************************************************
  * ItemChange: calls when new file opened
  *****************************************************************************/
@@ -819,7 +2406,7 @@ static int ItemChange( vlc_object_t *p_this, const char *psz_var,
     intf_sys_t     *p_sys   = p_intf->p_sys;
     char * newuri = NULL;
     char * newpath = NULL;
-    struct stat st;
+    char * path = NULL;
     int ret;
     bool b_autoload;
 
@@ -841,22 +2428,25 @@ static int ItemChange( vlc_object_t *p_this, const char *psz_var,
 			return VLC_SUCCESS;
 		}
 
-		newuri = uri_replace_ext( p_input_item->psz_uri, ".osd" );
-		if ( newuri )
+		path = vlc_uri2path( p_input_item->psz_uri );
+		if ( path )
+		{
+			// Lookup in the cached directory listing, no stat() per item
+			newpath = osd_find_file( p_intf, path );
+			free( path ); path = NULL;
+		}
+		if ( newpath )
 		{
-			newpath = vlc_uri2path( newuri );
-			if ( newpath )
+			// If osd-file exits, then add it as subtitles
+			newuri = vlc_path2uri( newpath, "file" );
+			if ( newuri )
 			{
-				// If osd-file exits, then add it as subtitles
-				if ( vlc_stat( newpath, &st ) == 0 )
-				{
-					ret = input_AddSlave( p_input, SLAVE_TYPE_SPU, newuri, true, true, false );
-					VLC_UNUSED( ret );
-					msg_Dbg( p_this, "ItemChange(): Auto-add OSD file as subtitles ret=%d", ret );
-				}
-				free( newpath ); newpath = NULL;
+				ret = input_AddSlave( p_input, SLAVE_TYPE_SPU, newuri, true, true, false );
+				VLC_UNUSED( ret );
+				msg_Dbg( p_this, "ItemChange(): Auto-add OSD file as subtitles ret=%d", ret );
+				free( newuri ); newuri = NULL;
 			}
-			free( newuri ); newuri = NULL;
+			free( newpath ); newpath = NULL;
 		}
     }
 
@@ -880,6 +2470,7 @@ static int OpenInterface( vlc_object_t *p_this )
 
     vlc_mutex_init( &p_sys->lock );
 
+    p_sys->dir_count = 0;
     p_sys->b_autoload = var_CreateGetBoolCommand( p_intf, CFG_AUTOLOAD );
 
     var_AddCallback( pl_Get( p_intf ), "input-current", ItemChange, p_intf );
@@ -903,51 +2494,288 @@ static void CloseInterface( vlc_object_t *p_this )
     var_DelCallback( pl_Get( p_intf ), "input-current", ItemChange, p_this );
     var_DelCallback( p_intf, CFG_AUTOLOAD, CfgCallback, p_sys );
 
+    for ( unsigned i = 0; i < p_sys->dir_count; i++ )
+        osd_dir_free( &p_sys->dirs[i] );
     vlc_mutex_destroy( &p_sys->lock );
 
     free( p_sys );
 }
 
 /*****************************************************************************
- * replace_ext: returns URI with new extension
+ * osd_key: lower-case copy of the first len chars of a file name
  *****************************************************************************/
-static char * uri_replace_ext(const char * uri, const char * newext)
+static char * osd_key(const char * name, size_t len)
 {
-	size_t n = strlen( uri );
-	const char *oldext;
-	char * newuri;
-
-	if ( uri == NULL || newext == NULL )
+	char * key = malloc( len + 1 );
+	if ( key == NULL )
 		return NULL;
 
-	// locate extension
-	for ( oldext = uri + n; oldext > uri; oldext-- )
+	for ( size_t i = 0; i < len; i++ )
+	{
+		char c = name[i];
+		key[i] = ( c >= 'A' && c <= 'Z' ) ? c - 'A' + 'a' : c;
+	}
+	key[len] = '\0';
+	return key;
+}
+
+static int osd_dir_entry_cmp(const void * a, const void * b)
+{
+	return strcmp( ((const osd_dir_entry_t *)a)->key, ((const osd_dir_entry_t *)b)->key );
+}
+
+/*****************************************************************************
+ * osd_dir_free:
+ *****************************************************************************/
+static void osd_dir_free(osd_dir_t * dir)
+{
+	for ( size_t i = 0; i < dir->count; i++ )
+	{
+		free( dir->entries[i].key );
+		free( dir->entries[i].file );
+	}
+	free( dir->entries ); dir->entries = NULL;
+	free( dir->path ); dir->path = NULL;
+	dir->count = 0;
+}
+
+/*****************************************************************************
+ * osd_dir_scan: reads the list of .osd files of a directory
+ *****************************************************************************/
+static int osd_dir_scan(vlc_object_t * obj, osd_dir_t * dir)
+{
+	static const char ext[] = ".osd";
+	const size_t ext_len = sizeof(ext) - 1;
+	size_t allocated = 0;
+	const char * name;
+	struct stat st;
+	DIR * dp;
+
+	for ( size_t i = 0; i < dir->count; i++ )
+	{
+		free( dir->entries[i].key );
+		free( dir->entries[i].file );
+	}
+	dir->count = 0;
+	dir->checked = mdate();
+
+	if ( vlc_stat( dir->path, &st ) != 0 )
+		return VLC_EGENERIC;
+	dir->mtime = st.st_mtime;
+
+	dp = vlc_opendir( dir->path );
+	if ( dp == NULL )
+		return VLC_EGENERIC;
+
+	while ( (name = vlc_readdir( dp )) != NULL )
 	{
-		if ( *oldext == '/' )
+		size_t len = strlen( name );
+		char * key;
+
+		if ( len <= ext_len || strcasecmp( name + len - ext_len, ext ) )
+			continue;
+
+		if ( dir->count == allocated )
 		{
-			// no extension
-			oldext = uri;
-			break;
+			size_t n = allocated ? allocated * 2 : 16;
+			osd_dir_entry_t * entries = realloc( dir->entries, n * sizeof(*entries) );
+			if ( entries == NULL )
+				break;
+			dir->entries = entries;
+			allocated = n;
 		}
-		if ( *oldext == '.' )
+
+		key = osd_key( name, len - ext_len );
+		dir->entries[dir->count].file = strdup( name );
+		if ( key == NULL || dir->entries[dir->count].file == NULL )
 		{
-			// found extension
+			free( key );
+			free( dir->entries[dir->count].file );
 			break;
 		}
+		dir->entries[dir->count].key = key;
+		dir->count++;
+	}
+	closedir( dp );
+
+	if ( dir->count > 1 )
+		qsort( dir->entries, dir->count, sizeof(*dir->entries), osd_dir_entry_cmp );
+
+	msg_Dbg( obj, "osd_dir_scan(): \"%s\" has %zu .osd files", dir->path, dir->count );
+	return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * osd_dir_index: position of the cached directory or -1. Under p_sys->lock
+ *****************************************************************************/
+static int osd_dir_index(const intf_sys_t * p_sys, const char * path, size_t len)
+{
+	for ( unsigned i = 0; i < p_sys->dir_count; i++ )
+	{
+		if ( strlen( p_sys->dirs[i].path ) == len && !memcmp( p_sys->dirs[i].path, path, len ) )
+			return i;
+	}
+	return -1;
+}
+
+/*****************************************************************************
+ * osd_dir_front: moves directory i to the front. Under p_sys->lock
+ *****************************************************************************/
+static osd_dir_t * osd_dir_front(intf_sys_t * p_sys, unsigned i)
+{
+	osd_dir_t dir = p_sys->dirs[i];
+
+	memmove( &p_sys->dirs[1], &p_sys->dirs[0], i * sizeof(dir) );
+	p_sys->dirs[0] = dir;
+	return &p_sys->dirs[0];
+}
+
+/*****************************************************************************
+ * osd_dir_install: caches a new listing, replacing the old one of the same
+ * directory or the least recently used one. Under p_sys->lock
+ *****************************************************************************/
+static osd_dir_t * osd_dir_install(intf_sys_t * p_sys, osd_dir_t * dir)
+{
+	int i = osd_dir_index( p_sys, dir->path, strlen( dir->path ) );
+
+	if ( i >= 0 )
+	{
+		osd_dir_free( &p_sys->dirs[i] );
 	}
-	if ( oldext == uri )
+	else
+	{
+		if ( p_sys->dir_count == DIR_CACHE_SIZE )
+			osd_dir_free( &p_sys->dirs[--p_sys->dir_count] );
+		i = p_sys->dir_count++;
+	}
+	p_sys->dirs[i] = *dir;
+	return osd_dir_front( p_sys, i );
+}
+
+static const char * osd_dir_lookup(const osd_dir_t * dir, const char * key)
+{
+	osd_dir_entry_t k = { .key = (char *)key, .file = NULL };
+	osd_dir_entry_t * e;
+
+	if ( key == NULL || dir->count == 0 )
+		return NULL;
+	e = bsearch( &k, dir->entries, dir->count, sizeof(*dir->entries), osd_dir_entry_cmp );
+	return e ? e->file : NULL;
+}
+
+/*****************************************************************************
+ * osd_dir_match: returns path of the first file matching one of the keys
+ *****************************************************************************/
+static char * osd_dir_match(const osd_dir_t * dir, char * const * keys, int key_count)
+{
+	const char * file = NULL;
+	char * osdpath;
+
+	for ( int i = 0; i < key_count && file == NULL; i++ )
+		file = osd_dir_lookup( dir, keys[i] );
+	if ( file == NULL )
+		return NULL;
+
+	osdpath = malloc( strlen( dir->path ) + strlen( file ) + 1 );
+	if ( osdpath )
 	{
-		// no extension
-		oldext = uri + n;
+		strcpy( osdpath, dir->path );
+		strcat( osdpath, file );
 	}
-	newuri = malloc( (oldext - uri) + strlen(newext) + 1 );
-	if ( newuri == NULL )
+	return osdpath;
+}
+
+/*****************************************************************************
+ * osd_find_file: returns path of .osd file for the video or NULL
+ *
+ * Names tried (case-insensitive):
+ *   DJIG0001.mp4 -> DJIG0001.osd
+ *   DJIG0001.mp4 -> DJIG0001.mp4.osd
+ *
+ * The directory is read (or its mtime checked) without p_sys->lock: on a
+ * slow network share that may take long.
+ *****************************************************************************/
+static char * osd_find_file(intf_thread_t * p_intf, const char * videopath)
+{
+	intf_sys_t * p_sys = p_intf->p_sys;
+	const char * name = strrchr( videopath, '/' );
+	const char * ext;
+	char * keys[2] = { NULL, NULL };
+	char * osdpath = NULL;
+	osd_dir_t dir;
+	size_t base_len, len;
+	time_t mtime = 0;
+	bool b_cached = false;
+	struct stat st;
+	int i;
+
+#ifdef _WIN32
+	const char * bslash = strrchr( videopath, '\\' );
+	if ( bslash && ( name == NULL || bslash > name ) )
+		name = bslash;
+#endif
+	if ( name == NULL )
 		return NULL;
+	name++;
+	len = name - videopath;
+
+	ext = strrchr( name, '.' );
+	base_len = ext ? (size_t)(ext - name) : strlen( name );
+
+	keys[0] = osd_key( name, base_len );
+	keys[1] = osd_key( name, strlen( name ) );
+
+	vlc_mutex_lock( &p_sys->lock );
+	i = osd_dir_index( p_sys, videopath, len );
+	if ( i >= 0 )
+	{
+		osd_dir_t * cached = osd_dir_front( p_sys, i );
+
+		// Network shares don't notify about changes: check mtime from time to time
+		if ( mdate() - cached->checked <= DIR_CACHE_RECHECK )
+		{
+			osdpath = osd_dir_match( cached, keys, 2 );
+			vlc_mutex_unlock( &p_sys->lock );
+			goto done;
+		}
+		mtime = cached->mtime;
+		b_cached = true;
+	}
+	vlc_mutex_unlock( &p_sys->lock );
+
+	memset( &dir, 0, sizeof(dir) );
+	dir.path = malloc( len + 1 );
+	if ( dir.path == NULL )
+		goto done;
+	memcpy( dir.path, videopath, len );
+	dir.path[len] = '\0';
+
+	if ( b_cached && vlc_stat( dir.path, &st ) == 0 && st.st_mtime == mtime )
+	{
+		// Unchanged: keep the cached listing
+		vlc_mutex_lock( &p_sys->lock );
+		i = osd_dir_index( p_sys, videopath, len );
+		if ( i >= 0 )
+		{
+			osd_dir_t * cached = osd_dir_front( p_sys, i );
+			cached->checked = mdate();
+			osdpath = osd_dir_match( cached, keys, 2 );
+		}
+		vlc_mutex_unlock( &p_sys->lock );
+		osd_dir_free( &dir );
+		goto done;
+	}
+
+	osd_dir_scan( VLC_OBJECT(p_intf), &dir );
 
-	strcpy( newuri, uri );
-	strcpy( newuri + (oldext - uri), newext );
+	vlc_mutex_lock( &p_sys->lock );
+	osdpath = osd_dir_match( osd_dir_install( p_sys, &dir ), keys, 2 );
+	vlc_mutex_unlock( &p_sys->lock );
 
-	return newuri;
+done:
+	for ( int k = 0; k < 2; k++ )
+		free( keys[k] );
+	return osdpath;
 }
 
 /*****************************************************************************
@@ -0,0 +1,102 @@
+/*****************************************************************************
+ * fpvosd.h : MSP-OSD (.osd) file format shared by the plugin and the tools
+ *****************************************************************************/
+
+#ifndef FPVOSD_H
+#define FPVOSD_H
+
+#include <stdint.h>
+
+#define FONT_BYTES_PER_PIXEL     4
+// Overlay dimensions
+#define DISPLAY_OVERLAY_WIDTH    1440
+#define DISPLAY_OVERLAY_HEIGHT   810
+// Dimensions for OSD
+#define DISPLAY_ORIGINAL_WIDTH   1440
+#define DISPLAY_ORIGINAL_HEIGHT  792
+
+// OSD grid size
+#define MAX_X  60
+#define MAX_Y  22
+
+// OSD font size
+#define FONT_WIDTH   24
+#define FONT_HEIGHT  36
+
+// Glyphs in one font page
+#define FONT_PAGE_CHARS  256
+
+// MSP-OSD
+#define MAGIC "MSPOSD"
+#define MSPOSD_VERSION 1
+
+// Size of the char map of one frame (column-major: map[MAX_Y * x + y])
+#define OSD_MAP_SIZE    (MAX_X * MAX_Y * sizeof(uint16_t))
+
+
+// OSD (.osd) file header
+typedef struct file_header_s
+{
+    char magic[7];
+    uint16_t version;
+    struct rec_config_s
+    {
+        uint8_t char_width;
+        uint8_t char_height;
+        uint8_t font_width;
+        uint8_t font_height;
+        uint16_t x_offset;
+        uint16_t y_offset;
+        uint8_t font_variant;
+    } __attribute__((packed)) config;
+} __attribute__((packed)) file_header_t;
+
+// Font variants
+enum  font_variant_e
+{
+    FONT_VARIANT_GENERIC = 0,
+    FONT_VARIANT_BETAFLIGHT = 1,
+    FONT_VARIANT_INAV = 2,
+    FONT_VARIANT_ARDUPILOT = 3,
+    FONT_VARIANT_KISS_ULTRA = 4,
+    FONT_VARIANT_QUICKSILVER = 5,
+	FONT_VARIANT__SIZE
+};
+
+// String codes for font variants
+static const char * font_variant_str[FONT_VARIANT__SIZE] __attribute__((unused)) = {
+        [FONT_VARIANT_GENERIC]="",
+        [FONT_VARIANT_BETAFLIGHT]="_bf",
+        [FONT_VARIANT_INAV]="_inav",
+        [FONT_VARIANT_ARDUPILOT]="_ardu",
+        [FONT_VARIANT_KISS_ULTRA]="_ultra",
+        [FONT_VARIANT_QUICKSILVER]="_quic",
+};
+
+// Frame header
+typedef struct frame_header_s {
+	uint32_t frame_idx;
+	uint32_t size;
+} __attribute__((packed)) frame_header_t;
+
+// Size of one frame record in the file (header + char map)
+#define OSD_FRAME_SIZE  (sizeof(frame_header_t) + OSD_MAP_SIZE)
+
+// Font file: <folder>/font<variant>_hd.bin, 256 glyphs of RGBA pixels
+#define FONT_FILE_PREFIX    "font"
+#define FONT_FILE_HD        "_hd"
+#define FONT_FILE_EXT       ".bin"
+#define FONT_PAGE_SIZE      (FONT_WIDTH * FONT_HEIGHT * FONT_BYTES_PER_PIXEL * FONT_PAGE_CHARS)
+
+/*****************************************************************************
+ * rgb_to_yuv:
+ *****************************************************************************/
+static inline void rgb_to_yuv( uint8_t *y, uint8_t *u, uint8_t *v,
+                               int r, int g, int b )
+{
+    *y = ( ( (  66 * r + 129 * g +  25 * b + 128 ) >> 8 ) + 16 );
+    *u =   ( ( -38 * r -  74 * g + 112 * b + 128 ) >> 8 ) + 128 ;
+    *v =   ( ( 112 * r -  94 * g -  18 * b + 128 ) >> 8 ) + 128 ;
+}
+
+#endif /* FPVOSD_H */
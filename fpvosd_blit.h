@@ -0,0 +1,163 @@
+/*****************************************************************************
+ * fpvosd_blit.h : glyph blitting kernels shared by the plugin and the bench
+ *****************************************************************************
+ * A glyph is copied from the font atlas (all glyphs of a page in one row)
+ * to the canvas. Kernels for the known font geometries and pixel formats
+ * are specialized at compile time: the row width is a constant, so the
+ * copies are unrolled, and all planes are copied in one pass over the
+ * lines. osd_blit_get() picks one, the generic kernel handles the rest.
+ *****************************************************************************/
+
+#ifndef FPVOSD_BLIT_H
+#define FPVOSD_BLIT_H
+
+#include <stdint.h>
+#include <string.h>
+
+// SD font size (msp-osd 30x15 grid)
+#define FONT_SD_WIDTH   36
+#define FONT_SD_HEIGHT  54
+
+#define OSD_BLIT_MAX_PLANES  4
+
+// Pixel formats of the atlas and the canvas
+enum osd_blit_format_e
+{
+    OSD_BLIT_YUVA = 0,      // 4 planes, 1 byte per pixel (VLC_CODEC_YUVA)
+    OSD_BLIT_RGBA,          // 1 plane, 4 bytes per pixel
+    OSD_BLIT__SIZE
+};
+
+typedef struct osd_plane_s
+{
+    uint8_t *pixels;
+    int pitch;
+} osd_plane_t;
+
+typedef struct osd_blit_s osd_blit_t;
+
+/* Copies glyph c to the canvas planes dst at pixel position (x, y) */
+typedef void (*osd_blit_fn)( const osd_blit_t *b, const osd_plane_t *dst, int x, int y, unsigned c );
+
+struct osd_blit_s
+{
+    int format;
+    int planes;
+    int pixel_pitch;
+    int cw, ch;                             // glyph size
+    osd_plane_t font[OSD_BLIT_MAX_PLANES];  // atlas
+    osd_blit_fn blit;
+    const char *name;
+};
+
+/*****************************************************************************
+ * osd_blit_generic: any geometry, plane by plane
+ *****************************************************************************/
+static inline void osd_blit_generic( const osd_blit_t *b, const osd_plane_t *dst, int x, int y, unsigned c )
+{
+    for ( int i_plane = 0; i_plane < b->planes; i_plane++ )
+    {
+        int i_pitch = dst[i_plane].pitch;
+        int i_pitch_font = b->font[i_plane].pitch;
+        for ( int i_line = 0; i_line < b->ch; i_line++ )
+        {
+            uint32_t offset = i_pitch * (i_line + y) + b->pixel_pitch * x;
+            uint32_t offset_font = i_pitch_font * i_line + b->pixel_pitch * b->cw * c;
+            memcpy( dst[i_plane].pixels + offset,
+                    b->font[i_plane].pixels + offset_font,
+                    b->pixel_pitch * b->cw );
+        }
+    }
+}
+
+/*****************************************************************************
+ * Specialized kernels
+ *****************************************************************************/
+#define OSD_BLIT_DEFINE_YUVA( cw, ch ) \
+static inline void osd_blit_yuva_##cw##x##ch( const osd_blit_t *b, const osd_plane_t *dst, \
+                                             int x, int y, unsigned c ) \
+{ \
+    uint8_t *d0 = dst[0].pixels + dst[0].pitch * y + x; \
+    uint8_t *d1 = dst[1].pixels + dst[1].pitch * y + x; \
+    uint8_t *d2 = dst[2].pixels + dst[2].pitch * y + x; \
+    uint8_t *d3 = dst[3].pixels + dst[3].pitch * y + x; \
+    const uint8_t *s0 = b->font[0].pixels + (cw) * c; \
+    const uint8_t *s1 = b->font[1].pixels + (cw) * c; \
+    const uint8_t *s2 = b->font[2].pixels + (cw) * c; \
+    const uint8_t *s3 = b->font[3].pixels + (cw) * c; \
+    for ( int i_line = 0; i_line < (ch); i_line++ ) \
+    { \
+        memcpy( d0, s0, (cw) ); \
+        memcpy( d1, s1, (cw) ); \
+        memcpy( d2, s2, (cw) ); \
+        memcpy( d3, s3, (cw) ); \
+        d0 += dst[0].pitch; s0 += b->font[0].pitch; \
+        d1 += dst[1].pitch; s1 += b->font[1].pitch; \
+        d2 += dst[2].pitch; s2 += b->font[2].pitch; \
+        d3 += dst[3].pitch; s3 += b->font[3].pitch; \
+    } \
+}
+
+#define OSD_BLIT_DEFINE_RGBA( cw, ch ) \
+static inline void osd_blit_rgba_##cw##x##ch( const osd_blit_t *b, const osd_plane_t *dst, \
+                                             int x, int y, unsigned c ) \
+{ \
+    uint8_t *d = dst[0].pixels + dst[0].pitch * y + 4 * x; \
+    const uint8_t *s = b->font[0].pixels + 4 * (cw) * c; \
+    for ( int i_line = 0; i_line < (ch); i_line++ ) \
+    { \
+        memcpy( d, s, 4 * (cw) ); \
+        d += dst[0].pitch; \
+        s += b->font[0].pitch; \
+    } \
+}
+
+OSD_BLIT_DEFINE_YUVA( 24, 36 )
+OSD_BLIT_DEFINE_YUVA( 36, 54 )
+OSD_BLIT_DEFINE_RGBA( 24, 36 )
+OSD_BLIT_DEFINE_RGBA( 36, 54 )
+
+/*****************************************************************************
+ * osd_blit_get: sets up b and selects the kernel for the geometry
+ *****************************************************************************
+ * font_planes are the planes of the atlas. Returns the kernel, which is
+ * also stored in b->blit.
+ *****************************************************************************/
+static inline osd_blit_fn osd_blit_get( osd_blit_t *b, int format, int cw, int ch,
+                                        const osd_plane_t *font_planes )
+{
+    static const struct
+    {
+        int format, cw, ch;
+        osd_blit_fn blit;
+        const char *name;
+    } kernels[] = {
+        { OSD_BLIT_YUVA, 24, 36, osd_blit_yuva_24x36, "yuva-24x36" },
+        { OSD_BLIT_YUVA, 36, 54, osd_blit_yuva_36x54, "yuva-36x54" },
+        { OSD_BLIT_RGBA, 24, 36, osd_blit_rgba_24x36, "rgba-24x36" },
+        { OSD_BLIT_RGBA, 36, 54, osd_blit_rgba_36x54, "rgba-36x54" },
+    };
+
+    b->format = format;
+    b->planes = format == OSD_BLIT_YUVA ? 4 : 1;
+    b->pixel_pitch = format == OSD_BLIT_YUVA ? 1 : 4;
+    b->cw = cw;
+    b->ch = ch;
+    for ( int i = 0; i < b->planes; i++ )
+        b->font[i] = font_planes[i];
+    b->blit = osd_blit_generic;
+    b->name = "generic";
+
+    for ( unsigned i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++ )
+    {
+        if ( kernels[i].format == format && kernels[i].cw == cw && kernels[i].ch == ch )
+        {
+            b->blit = kernels[i].blit;
+            b->name = kernels[i].name;
+            break;
+        }
+    }
+    return b->blit;
+}
+
+#endif /* FPVOSD_BLIT_H */
@@ -0,0 +1,593 @@
+/*****************************************************************************
+ * osd2sup : converts MSP-OSD .osd files to PGS (.sup) bitmap subtitles
+ *****************************************************************************
+ * Renders the OSD with the same font and layout as the VLC plugin into a
+ * palettized canvas and writes a PGS display set each time the char map
+ * changes. The .sup file can be muxed into MKV (e.g. with mkvmerge).
+ *
+ * Usage: osd2sup [options] input.osd output.sup
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "fpvosd.h"
+
+// PGS segment types
+#define PGS_PDS  0x14
+#define PGS_ODS  0x15
+#define PGS_PCS  0x16
+#define PGS_WDS  0x17
+#define PGS_END  0x80
+
+#define PGS_CLOCK          90000
+#define PGS_SEGMENT_MAX    0xFFFF
+// Worst case RLE line: 2 bytes per pixel + end of line
+#define RLE_LINE_MAX(w)    (2 * (size_t)(w) + 2)
+
+typedef struct palette_entry_s
+{
+    uint8_t r, g, b, a;
+} palette_entry_t;
+
+static struct
+{
+    double fps;
+    int width, height;              // output (video) size
+    const char *font_dir;
+    const char *font_file;
+} cfg;
+
+// Font glyphs as palette indexes: [char][line][column]
+static uint8_t glyphs[FONT_PAGE_CHARS][FONT_HEIGHT][FONT_WIDTH];
+static palette_entry_t palette[256];
+static int palette_size;
+
+// Palettized OSD overlay
+static uint8_t canvas[DISPLAY_OVERLAY_HEIGHT][DISPLAY_OVERLAY_WIDTH];
+
+static uint8_t *rle_buf;
+static uint8_t *segment_buf;
+static uint16_t composition_number;
+
+
+static void usage( const char *prog )
+{
+    fprintf( stderr,
+        "Usage: %s [options] input.osd output.sup\n"
+        "  -d folder   font folder (font<variant>_hd.bin is chosen as in the plugin)\n"
+        "  -b file     font file (overrides -d)\n"
+        "  -f fps      frame rate of the recording (default 60)\n"
+        "  -s WxH      video size (default 1920x1080)\n",
+        prog );
+}
+
+/*****************************************************************************
+ * Font
+ *****************************************************************************/
+static int palette_index( const uint8_t *px, int shift )
+{
+    // Fully transparent pixels share index 0
+    if ( px[3] == 0 )
+        return 0;
+
+    const uint8_t r = px[0] >> shift << shift;
+    const uint8_t g = px[1] >> shift << shift;
+    const uint8_t b = px[2] >> shift << shift;
+    const uint8_t a = px[3] >> shift << shift;
+
+    for ( int i = 1; i < palette_size; i++ )
+    {
+        if ( palette[i].r == r && palette[i].g == g && palette[i].b == b && palette[i].a == a )
+            return i;
+    }
+    if ( palette_size == 256 )
+        return -1;
+
+    palette[palette_size] = (palette_entry_t){ r, g, b, a };
+    return palette_size++;
+}
+
+/* Converts the RGBA font to palette indexes. Fonts use a few colors; if
+ * there are more than 255, color depth is reduced until they fit */
+static int font_palettize( const uint8_t *font )
+{
+    for ( int shift = 0; shift < 8; shift++ )
+    {
+        bool b_fit = true;
+
+        palette_size = 1;
+        palette[0] = (palette_entry_t){ 0, 0, 0, 0 };
+
+        for ( int c = 0; c < FONT_PAGE_CHARS && b_fit; c++ )
+        {
+            const uint8_t *font_char = font + FONT_WIDTH * FONT_HEIGHT * FONT_BYTES_PER_PIXEL * c;
+            for ( int y = 0; y < FONT_HEIGHT && b_fit; y++ )
+            {
+                for ( int x = 0; x < FONT_WIDTH; x++ )
+                {
+                    int i = palette_index( font_char + (y * FONT_WIDTH + x) * FONT_BYTES_PER_PIXEL, shift );
+                    if ( i < 0 )
+                    {
+                        b_fit = false;
+                        break;
+                    }
+                    glyphs[c][y][x] = i;
+                }
+            }
+        }
+
+        if ( b_fit )
+        {
+            if ( shift > 0 )
+                fprintf( stderr, "Font has more than 255 colors, reduced by %d bits\n", shift );
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int font_load( int variant )
+{
+    char path[4096];
+    uint8_t *font;
+    FILE *fp;
+    int rtn = -1;
+
+    if ( cfg.font_file )
+        snprintf( path, sizeof(path), "%s", cfg.font_file );
+    else
+        snprintf( path, sizeof(path), "%s/" FONT_FILE_PREFIX "%s" FONT_FILE_HD FONT_FILE_EXT,
+                  cfg.font_dir, font_variant_str[variant] );
+
+    font = malloc( FONT_PAGE_SIZE );
+    if ( font == NULL )
+        return -1;
+
+    fp = fopen( path, "rb" );
+    if ( fp == NULL )
+    {
+        fprintf( stderr, "%s: %s\n", path, strerror(errno) );
+        goto cleanup;
+    }
+    if ( fread( font, FONT_PAGE_SIZE, 1, fp ) != 1 )
+    {
+        fprintf( stderr, "%s: incorrect size of font file\n", path );
+        goto cleanup;
+    }
+
+    rtn = font_palettize( font );
+
+cleanup:
+    if ( fp )
+        fclose( fp );
+    free( font );
+    return rtn;
+}
+
+/*****************************************************************************
+ * Rendering
+ *****************************************************************************/
+typedef struct rect_s
+{
+    int x0, y0, x1, y1;     // [x0, x1) x [y0, y1)
+} rect_t;
+
+/* Draws non-null chars like the plugin does; returns false if the map is
+ * empty, otherwise the bounding box of the drawn cells */
+static bool render_map( const uint16_t *map, rect_t *box )
+{
+    const int yoffset = (DISPLAY_OVERLAY_HEIGHT - DISPLAY_ORIGINAL_HEIGHT) / 2;
+    const int xoffset = (DISPLAY_OVERLAY_WIDTH - DISPLAY_ORIGINAL_WIDTH) / 2;
+    int min_x = MAX_X, min_y = MAX_Y, max_x = -1, max_y = -1;
+
+    memset( canvas, 0, sizeof(canvas) );
+
+    for ( int x = 0; x < MAX_X; x++ )
+    {
+        for ( int y = 0; y < MAX_Y; y++ )
+        {
+            uint16_t c = map[MAX_Y * x + y];
+            if ( c == 0 )
+                continue;
+            c &= 0xFF;
+
+            for ( int line = 0; line < FONT_HEIGHT; line++ )
+                memcpy( &canvas[yoffset + y * FONT_HEIGHT + line][xoffset + x * FONT_WIDTH],
+                        glyphs[c][line], FONT_WIDTH );
+
+            if ( x < min_x ) min_x = x;
+            if ( x > max_x ) max_x = x;
+            if ( y < min_y ) min_y = y;
+            if ( y > max_y ) max_y = y;
+        }
+    }
+
+    if ( max_x < 0 )
+        return false;
+
+    box->x0 = xoffset + min_x * FONT_WIDTH;
+    box->x1 = xoffset + (max_x + 1) * FONT_WIDTH;
+    box->y0 = yoffset + min_y * FONT_HEIGHT;
+    box->y1 = yoffset + (max_y + 1) * FONT_HEIGHT;
+    return true;
+}
+
+/*****************************************************************************
+ * PGS run-length encoding of one line
+ *****************************************************************************/
+static size_t rle_run( uint8_t *p, uint8_t color, int len )
+{
+    size_t n = 0;
+
+    if ( color != 0 && len <= 2 )
+    {
+        // Single pixels are cheaper as plain bytes
+        for ( int i = 0; i < len; i++ )
+            p[n++] = color;
+        return n;
+    }
+
+    p[n++] = 0;
+    if ( color == 0 )
+    {
+        if ( len < 64 )
+            p[n++] = len;
+        else
+        {
+            p[n++] = 0x40 | (len >> 8);
+            p[n++] = len & 0xFF;
+        }
+    }
+    else
+    {
+        if ( len < 64 )
+            p[n++] = 0x80 | len;
+        else
+        {
+            p[n++] = 0xC0 | (len >> 8);
+            p[n++] = len & 0xFF;
+        }
+        p[n++] = color;
+    }
+    return n;
+}
+
+static size_t rle_line( uint8_t *p, const uint8_t *src, const int *src_x, int width )
+{
+    size_t n = 0;
+
+    for ( int x = 0; x < width; )
+    {
+        const uint8_t color = src[src_x[x]];
+        int len = 1;
+        while ( x + len < width && len < 0x3FFF && src[src_x[x + len]] == color )
+            len++;
+        n += rle_run( p + n, color, len );
+        x += len;
+    }
+
+    // End of line
+    p[n++] = 0;
+    p[n++] = 0;
+    return n;
+}
+
+/*****************************************************************************
+ * PGS segments
+ *****************************************************************************/
+static uint8_t * put16( uint8_t *p, unsigned v )
+{
+    *p++ = v >> 8;
+    *p++ = v;
+    return p;
+}
+
+static uint8_t * put32( uint8_t *p, uint32_t v )
+{
+    p = put16( p, v >> 16 );
+    return put16( p, v & 0xFFFF );
+}
+
+static int write_segment( FILE *out, uint32_t pts, uint8_t type, const uint8_t *data, size_t size )
+{
+    uint8_t hdr[13], *p = hdr;
+
+    *p++ = 'P';
+    *p++ = 'G';
+    p = put32( p, pts );
+    p = put32( p, 0 );      // DTS
+    *p++ = type;
+    p = put16( p, size );
+
+    if ( fwrite( hdr, sizeof(hdr), 1, out ) != 1 ||
+         ( size > 0 && fwrite( data, size, 1, out ) != 1 ) )
+        return -1;
+    return 0;
+}
+
+static int write_pcs( FILE *out, uint32_t pts, bool b_object, int x, int y )
+{
+    uint8_t buf[19], *p = buf;
+
+    p = put16( p, cfg.width );
+    p = put16( p, cfg.height );
+    *p++ = 0x10;                        // frame rate (ignored by players)
+    p = put16( p, composition_number++ );
+    *p++ = 0x80;                        // epoch start: every set is self-contained
+    *p++ = 0x00;                        // palette update flag
+    *p++ = 0;                           // palette id
+    *p++ = b_object ? 1 : 0;
+    if ( b_object )
+    {
+        p = put16( p, 0 );              // object id
+        *p++ = 0;                       // window id
+        *p++ = 0x00;                    // not cropped
+        p = put16( p, x );
+        p = put16( p, y );
+    }
+    return write_segment( out, pts, PGS_PCS, buf, p - buf );
+}
+
+static int write_wds( FILE *out, uint32_t pts )
+{
+    uint8_t buf[10], *p = buf;
+
+    *p++ = 1;                           // one window: whole video
+    *p++ = 0;
+    p = put16( p, 0 );
+    p = put16( p, 0 );
+    p = put16( p, cfg.width );
+    p = put16( p, cfg.height );
+    return write_segment( out, pts, PGS_WDS, buf, p - buf );
+}
+
+static int write_pds( FILE *out, uint32_t pts )
+{
+    uint8_t buf[2 + 256 * 5], *p = buf;
+
+    *p++ = 0;                           // palette id
+    *p++ = 0;                           // version
+    for ( int i = 0; i < palette_size; i++ )
+    {
+        uint8_t y, u, v;
+        rgb_to_yuv( &y, &u, &v, palette[i].r, palette[i].g, palette[i].b );
+        *p++ = i;
+        *p++ = y;
+        *p++ = v;                       // Cr
+        *p++ = u;                       // Cb
+        *p++ = palette[i].a;
+    }
+    return write_segment( out, pts, PGS_PDS, buf, p - buf );
+}
+
+/* Object data may span several segments */
+static int write_ods( FILE *out, uint32_t pts, const uint8_t *rle, size_t rle_size, int w, int h )
+{
+    const size_t first_hdr = 11, next_hdr = 4;
+    size_t done = 0;
+    bool b_first = true;
+
+    do
+    {
+        const size_t hdr = b_first ? first_hdr : next_hdr;
+        size_t chunk = rle_size - done;
+        uint8_t *p = segment_buf;
+
+        if ( chunk > PGS_SEGMENT_MAX - hdr )
+            chunk = PGS_SEGMENT_MAX - hdr;
+
+        p = put16( p, 0 );              // object id
+        *p++ = 0;                       // version
+        *p++ = ( b_first ? 0x80 : 0 ) | ( done + chunk == rle_size ? 0x40 : 0 );
+        if ( b_first )
+        {
+            const uint32_t len = rle_size + 4;
+            *p++ = len >> 16;
+            p = put16( p, len & 0xFFFF );
+            p = put16( p, w );
+            p = put16( p, h );
+        }
+        memcpy( p, rle + done, chunk );
+        if ( write_segment( out, pts, PGS_ODS, segment_buf, hdr + chunk ) )
+            return -1;
+
+        done += chunk;
+        b_first = false;
+    } while ( done < rle_size );
+
+    return 0;
+}
+
+/* Display set with the canvas area box scaled to the output size */
+static int write_display_set( FILE *out, uint32_t pts, const rect_t *box )
+{
+    static int src_x[8192];
+    const int ox0 = (int64_t)box->x0 * cfg.width / DISPLAY_OVERLAY_WIDTH;
+    const int oy0 = (int64_t)box->y0 * cfg.height / DISPLAY_OVERLAY_HEIGHT;
+    const int ox1 = ((int64_t)box->x1 * cfg.width + DISPLAY_OVERLAY_WIDTH - 1) / DISPLAY_OVERLAY_WIDTH;
+    const int oy1 = ((int64_t)box->y1 * cfg.height + DISPLAY_OVERLAY_HEIGHT - 1) / DISPLAY_OVERLAY_HEIGHT;
+    const int w = ox1 - ox0, h = oy1 - oy0;
+    size_t rle_size = 0;
+
+    // Nearest neighbour scaling
+    for ( int x = 0; x < w; x++ )
+        src_x[x] = (int64_t)(ox0 + x) * DISPLAY_OVERLAY_WIDTH / cfg.width;
+    for ( int y = 0; y < h; y++ )
+    {
+        const int sy = (int64_t)(oy0 + y) * DISPLAY_OVERLAY_HEIGHT / cfg.height;
+        rle_size += rle_line( rle_buf + rle_size, canvas[sy], src_x, w );
+    }
+
+    if ( write_pcs( out, pts, true, ox0, oy0 ) ||
+         write_wds( out, pts ) ||
+         write_pds( out, pts ) ||
+         write_ods( out, pts, rle_buf, rle_size, w, h ) ||
+         write_segment( out, pts, PGS_END, NULL, 0 ) )
+        return -1;
+    return 0;
+}
+
+static int write_clear( FILE *out, uint32_t pts )
+{
+    if ( write_pcs( out, pts, false, 0, 0 ) ||
+         write_wds( out, pts ) ||
+         write_segment( out, pts, PGS_END, NULL, 0 ) )
+        return -1;
+    return 0;
+}
+
+/*****************************************************************************
+ * convert:
+ *****************************************************************************/
+static int convert( const char *in_path, const char *out_path )
+{
+    file_header_t hdr;
+    uint8_t frame[OSD_FRAME_SIZE];
+    uint16_t map[MAX_X * MAX_Y], prev_map[MAX_X * MAX_Y];
+    bool b_shown = false, b_have_prev = false;
+    uint32_t last_idx = 0;
+    unsigned sets = 0;
+    int rtn = -1;
+    FILE *in = NULL, *out = NULL;
+
+    in = fopen( in_path, "rb" );
+    if ( in == NULL )
+    {
+        fprintf( stderr, "%s: %s\n", in_path, strerror(errno) );
+        goto cleanup;
+    }
+    if ( fread( &hdr, sizeof(hdr), 1, in ) != 1 ||
+         memcmp( hdr.magic, MAGIC, sizeof(hdr.magic) ) ||
+         hdr.version != MSPOSD_VERSION )
+    {
+        fprintf( stderr, "%s: not an MSP-OSD v%d file\n", in_path, MSPOSD_VERSION );
+        goto cleanup;
+    }
+    if ( font_load( hdr.config.font_variant < FONT_VARIANT__SIZE ?
+                    hdr.config.font_variant : FONT_VARIANT_GENERIC ) )
+        goto cleanup;
+
+    out = fopen( out_path, "wb" );
+    if ( out == NULL )
+    {
+        fprintf( stderr, "%s: %s\n", out_path, strerror(errno) );
+        goto cleanup;
+    }
+
+    while ( fread( frame, sizeof(frame), 1, in ) == 1 )
+    {
+        frame_header_t fh;
+        rect_t box;
+        uint32_t pts;
+
+        memcpy( &fh, frame, sizeof(fh) );
+        memcpy( map, frame + sizeof(fh), sizeof(map) );
+        last_idx = fh.frame_idx;
+
+        // Only changes of the map are encoded
+        if ( b_have_prev && !memcmp( map, prev_map, sizeof(map) ) )
+            continue;
+        memcpy( prev_map, map, sizeof(map) );
+        b_have_prev = true;
+
+        pts = (uint32_t)(fh.frame_idx * (double)PGS_CLOCK / cfg.fps);
+        if ( render_map( map, &box ) )
+        {
+            if ( write_display_set( out, pts, &box ) )
+                goto write_error;
+            b_shown = true;
+            sets++;
+        }
+        else if ( b_shown )
+        {
+            if ( write_clear( out, pts ) )
+                goto write_error;
+            b_shown = false;
+            sets++;
+        }
+    }
+
+    // Hide the OSD one frame after the last one
+    if ( b_shown && write_clear( out, (uint32_t)((last_idx + 1) * (double)PGS_CLOCK / cfg.fps) ) )
+        goto write_error;
+
+    fprintf( stderr, "%s: %u display sets, %d colors\n", out_path, sets, palette_size );
+    rtn = 0;
+    goto cleanup;
+
+write_error:
+    fprintf( stderr, "%s: write error\n", out_path );
+
+cleanup:
+    if ( in )
+        fclose( in );
+    if ( out && fclose( out ) )
+        rtn = -1;
+    return rtn;
+}
+
+int main( int argc, char **argv )
+{
+    int opt;
+    int rtn;
+
+    cfg.fps = 60;
+    cfg.width = 1920;
+    cfg.height = 1080;
+    cfg.font_dir = ".";
+
+    while ( (opt = getopt( argc, argv, "d:b:f:s:h" )) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'd':
+            cfg.font_dir = optarg;
+            break;
+        case 'b':
+            cfg.font_file = optarg;
+            break;
+        case 'f':
+            cfg.fps = atof( optarg );
+            if ( cfg.fps <= 0 )
+                cfg.fps = 60;
+            break;
+        case 's':
+            if ( sscanf( optarg, "%dx%d", &cfg.width, &cfg.height ) != 2 ||
+                 cfg.width <= 0 || cfg.width > 4096 || cfg.height <= 0 || cfg.height > 4096 )
+            {
+                fprintf( stderr, "Bad size \"%s\"\n", optarg );
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage( argv[0] );
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if ( argc - optind != 2 )
+    {
+        usage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    rle_buf = malloc( RLE_LINE_MAX(cfg.width) * cfg.height );
+    segment_buf = malloc( PGS_SEGMENT_MAX );
+    if ( rle_buf == NULL || segment_buf == NULL )
+    {
+        fprintf( stderr, "Out of memory\n" );
+        return EXIT_FAILURE;
+    }
+
+    rtn = convert( argv[optind], argv[optind + 1] ) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    free( rle_buf );
+    free( segment_buf );
+    return rtn;
+}
@@ -0,0 +1,527 @@
+/*****************************************************************************
+ * osd2txt : extracts OSD text (telemetry) from MSP-OSD .osd files
+ *****************************************************************************
+ * Streams through .osd files frame by frame, maps glyph codes to characters
+ * for the font variant of the file and prints selected cell regions as
+ * CSV or NDJSON. A line is emitted only when one of the regions changes.
+ *
+ * Usage: osd2txt [options] file.osd [file.osd ...]
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "fpvosd.h"
+
+#define MAX_REGIONS        64
+#define MAX_NAME           32
+#define MAX_GLYPHS         (2 * FONT_PAGE_CHARS)
+// Frames read from the file at once (~2.7 MB)
+#define FRAMES_PER_READ    1024
+
+typedef struct region_s
+{
+    char name[MAX_NAME];
+    int x, y, w;
+} region_t;
+
+typedef enum
+{
+    OUTPUT_CSV,
+    OUTPUT_NDJSON,
+} output_format_e;
+
+typedef struct glyph_sym_s
+{
+    uint16_t code;
+    const char *str;
+} glyph_sym_t;
+
+// Betaflight symbols which carry a meaning for telemetry (units)
+static const glyph_sym_t betaflight_syms[] = {
+    { 0x06, "V" },      // SYM_VOLT
+    { 0x07, "mAh" },    // SYM_MAH
+    { 0x0C, "m" },      // SYM_M
+    { 0x0D, "F" },      // SYM_F
+    { 0x0E, "C" },      // SYM_C
+    { 0x0F, "ft" },     // SYM_FT
+    { 0x7D, "km" },     // SYM_KM
+    { 0x7E, "mi" },     // SYM_MILES
+    { 0x9A, "A" },      // SYM_AMP
+    { 0x9D, "mph" },    // SYM_MPH
+    { 0x9E, "km/h" },   // SYM_KPH
+};
+
+static struct
+{
+    region_t regions[MAX_REGIONS];
+    int region_count;
+    int region_cells;
+    output_format_e format;
+    double fps;
+    int variant;              // -1: from the file header
+    bool all_frames;
+    bool trim;
+    const char *placeholder;  // for glyphs without a character
+    const char *user_map[MAX_GLYPHS];
+    FILE *out;
+} cfg;
+
+// glyph code -> string for the current font variant
+static const char *charmap[MAX_GLYPHS];
+
+static uint8_t frame_buf[FRAMES_PER_READ * OSD_FRAME_SIZE];
+
+
+static void usage( const char *prog )
+{
+    fprintf( stderr,
+        "Usage: %s [options] file.osd [file.osd ...]\n"
+        "  -r name=x,y,w  region of w cells from column x, row y (repeatable).\n"
+        "                 Default: every row of the OSD\n"
+        "  -F csv|ndjson  output format (default csv)\n"
+        "  -f fps         frame rate of the recording (default 60)\n"
+        "  -v variant     font variant: generic, bf, inav, ardu, ultra, quic\n"
+        "                 (default: from the file header)\n"
+        "  -m file        glyph map: lines \"<code> <string>\", code dec or 0x hex\n"
+        "  -u string      text for glyphs without a character (default empty)\n"
+        "  -a             emit every frame, not only changes\n"
+        "  -n             do not trim spaces around values\n"
+        "  -o file        output file (default stdout)\n",
+        prog );
+}
+
+/*****************************************************************************
+ * charmap_build: fills charmap for a font variant
+ *****************************************************************************/
+static void charmap_build( int variant )
+{
+    static char ascii[128][2];
+    int last_ascii = 0x7E;
+
+    // Betaflight font keeps its symbols in place of lowercase letters
+    if ( variant == FONT_VARIANT_BETAFLIGHT )
+        last_ascii = 0x5F;
+
+    for ( int c = 0; c < MAX_GLYPHS; c++ )
+    {
+        if ( c >= 0x20 && c <= last_ascii )
+        {
+            ascii[c][0] = (char)c;
+            ascii[c][1] = '\0';
+            charmap[c] = ascii[c];
+        }
+        else
+        {
+            charmap[c] = cfg.placeholder;
+        }
+    }
+    charmap[0] = " ";
+
+    if ( variant == FONT_VARIANT_BETAFLIGHT )
+    {
+        for ( size_t i = 0; i < sizeof(betaflight_syms) / sizeof(betaflight_syms[0]); i++ )
+            charmap[betaflight_syms[i].code] = betaflight_syms[i].str;
+    }
+
+    for ( int c = 0; c < MAX_GLYPHS; c++ )
+    {
+        if ( cfg.user_map[c] )
+            charmap[c] = cfg.user_map[c];
+    }
+}
+
+/*****************************************************************************
+ * load_user_map: reads "<code> <string>" lines
+ *****************************************************************************/
+static int load_user_map( const char *path )
+{
+    char line[256];
+    FILE *fp = fopen( path, "r" );
+    if ( fp == NULL )
+    {
+        fprintf( stderr, "%s: %s\n", path, strerror(errno) );
+        return -1;
+    }
+
+    while ( fgets( line, sizeof(line), fp ) )
+    {
+        char *end;
+        long code;
+
+        line[strcspn( line, "\r\n" )] = '\0';
+        if ( line[0] == '#' || line[0] == '\0' )
+            continue;
+
+        code = strtol( line, &end, 0 );
+        if ( end == line || code < 0 || code >= MAX_GLYPHS )
+        {
+            fprintf( stderr, "%s: bad line \"%s\"\n", path, line );
+            continue;
+        }
+        if ( *end == ' ' || *end == '\t' )
+            end++;
+        cfg.user_map[code] = strdup( end );
+    }
+
+    fclose( fp );
+    return 0;
+}
+
+static int parse_region( const char *arg )
+{
+    region_t *r;
+    const char *eq = strchr( arg, '=' );
+
+    if ( cfg.region_count >= MAX_REGIONS )
+    {
+        fprintf( stderr, "Too many regions (max %d)\n", MAX_REGIONS );
+        return -1;
+    }
+    if ( eq == NULL || eq == arg || eq - arg >= MAX_NAME )
+        goto error;
+
+    r = &cfg.regions[cfg.region_count];
+    memcpy( r->name, arg, eq - arg );
+    r->name[eq - arg] = '\0';
+    if ( sscanf( eq + 1, "%d,%d,%d", &r->x, &r->y, &r->w ) != 3 ||
+         r->x < 0 || r->y < 0 || r->y >= MAX_Y || r->w <= 0 || r->x + r->w > MAX_X )
+        goto error;
+
+    cfg.region_count++;
+    return 0;
+
+error:
+    fprintf( stderr, "Bad region \"%s\". Expected name=x,y,w inside %dx%d\n", arg, MAX_X, MAX_Y );
+    return -1;
+}
+
+static int parse_variant( const char *arg )
+{
+    if ( !strcmp( arg, "generic" ) )
+        return FONT_VARIANT_GENERIC;
+    for ( int i = 1; i < FONT_VARIANT__SIZE; i++ )
+    {
+        // font_variant_str has the "_" prefix
+        if ( !strcmp( arg, font_variant_str[i] + 1 ) )
+            return i;
+    }
+    return -1;
+}
+
+/*****************************************************************************
+ * Output
+ *****************************************************************************/
+static void put_csv_value( const char *s )
+{
+    if ( s[strcspn( s, ",\"\n" )] == '\0' )
+    {
+        fputs( s, cfg.out );
+        return;
+    }
+    fputc( '"', cfg.out );
+    for ( ; *s; s++ )
+    {
+        if ( *s == '"' )
+            fputc( '"', cfg.out );
+        fputc( *s, cfg.out );
+    }
+    fputc( '"', cfg.out );
+}
+
+static void put_json_string( const char *s )
+{
+    fputc( '"', cfg.out );
+    for ( ; *s; s++ )
+    {
+        unsigned char c = (unsigned char)*s;
+        if ( c == '"' || c == '\\' )
+            fprintf( cfg.out, "\\%c", c );
+        else if ( c < 0x20 )
+            fprintf( cfg.out, "\\u%04x", c );
+        else
+            fputc( c, cfg.out );
+    }
+    fputc( '"', cfg.out );
+}
+
+static void put_header( void )
+{
+    if ( cfg.format != OUTPUT_CSV )
+        return;
+
+    fputs( "file,frame,time_ms", cfg.out );
+    for ( int i = 0; i < cfg.region_count; i++ )
+    {
+        fputc( ',', cfg.out );
+        put_csv_value( cfg.regions[i].name );
+    }
+    fputc( '\n', cfg.out );
+}
+
+/*****************************************************************************
+ * region_text: converts cells of a region to a string
+ *****************************************************************************/
+static const char * region_text( const uint16_t *codes, int w, char *buf, size_t size )
+{
+    size_t len = 0;
+    char *start;
+
+    for ( int i = 0; i < w; i++ )
+    {
+        uint16_t c = codes[i];
+        const char *s = c < MAX_GLYPHS ? charmap[c] : cfg.placeholder;
+        size_t n = strlen( s );
+        if ( len + n >= size )
+            break;
+        memcpy( buf + len, s, n );
+        len += n;
+    }
+    buf[len] = '\0';
+
+    if ( !cfg.trim )
+        return buf;
+
+    while ( len > 0 && buf[len - 1] == ' ' )
+        buf[--len] = '\0';
+    for ( start = buf; *start == ' '; start++ )
+        ;
+    return start;
+}
+
+static void put_record( const char *file, uint32_t frame_idx, const uint16_t *codes )
+{
+    char text[MAX_X * 8 + 1];
+    double time_ms = frame_idx * 1000.0 / cfg.fps;
+
+    if ( cfg.format == OUTPUT_CSV )
+    {
+        put_csv_value( file );
+        fprintf( cfg.out, ",%u,%.3f", frame_idx, time_ms );
+    }
+    else
+    {
+        fputs( "{\"file\":", cfg.out );
+        put_json_string( file );
+        fprintf( cfg.out, ",\"frame\":%u,\"time_ms\":%.3f", frame_idx, time_ms );
+    }
+
+    for ( int i = 0; i < cfg.region_count; i++ )
+    {
+        const char *s = region_text( codes, cfg.regions[i].w, text, sizeof(text) );
+        codes += cfg.regions[i].w;
+
+        if ( cfg.format == OUTPUT_CSV )
+        {
+            fputc( ',', cfg.out );
+            put_csv_value( s );
+        }
+        else
+        {
+            fputc( ',', cfg.out );
+            put_json_string( cfg.regions[i].name );
+            fputc( ':', cfg.out );
+            put_json_string( s );
+        }
+    }
+
+    fputs( cfg.format == OUTPUT_CSV ? "\n" : "}\n", cfg.out );
+}
+
+/*****************************************************************************
+ * gather_regions: copies cells of all regions in a row-major buffer
+ *****************************************************************************/
+static void gather_regions( const uint8_t *map, uint16_t *codes )
+{
+    for ( int i = 0; i < cfg.region_count; i++ )
+    {
+        const region_t *r = &cfg.regions[i];
+        for ( int x = r->x; x < r->x + r->w; x++ )
+            memcpy( codes++, map + sizeof(uint16_t) * (MAX_Y * x + r->y), sizeof(uint16_t) );
+    }
+}
+
+/*****************************************************************************
+ * process_file:
+ *****************************************************************************/
+static int process_file( const char *path )
+{
+    file_header_t hdr;
+    uint8_t prev_map[OSD_MAP_SIZE];
+    uint16_t codes[MAX_REGIONS * MAX_X], prev_codes[MAX_REGIONS * MAX_X];
+    const size_t codes_size = cfg.region_cells * sizeof(uint16_t);
+    bool have_prev = false;
+    size_t n;
+    int variant;
+    FILE *fp = fopen( path, "rb" );
+
+    if ( fp == NULL )
+    {
+        fprintf( stderr, "%s: %s\n", path, strerror(errno) );
+        return -1;
+    }
+
+    if ( fread( &hdr, sizeof(hdr), 1, fp ) != 1 ||
+         memcmp( hdr.magic, MAGIC, sizeof(hdr.magic) ) ||
+         hdr.version != MSPOSD_VERSION )
+    {
+        fprintf( stderr, "%s: not an MSP-OSD v%d file\n", path, MSPOSD_VERSION );
+        fclose( fp );
+        return -1;
+    }
+
+    variant = cfg.variant >= 0 ? cfg.variant : hdr.config.font_variant;
+    if ( variant >= FONT_VARIANT__SIZE )
+        variant = FONT_VARIANT_GENERIC;
+    charmap_build( variant );
+
+    while ( (n = fread( frame_buf, OSD_FRAME_SIZE, FRAMES_PER_READ, fp )) > 0 )
+    {
+        for ( size_t i = 0; i < n; i++ )
+        {
+            const uint8_t *frame = frame_buf + i * OSD_FRAME_SIZE;
+            const uint8_t *map = frame + sizeof(frame_header_t);
+            frame_header_t fh;
+
+            // Most frames repeat the previous one: whole-map compare first
+            if ( have_prev && !cfg.all_frames && !memcmp( map, prev_map, OSD_MAP_SIZE ) )
+                continue;
+
+            gather_regions( map, codes );
+            if ( have_prev && !cfg.all_frames && !memcmp( codes, prev_codes, codes_size ) )
+            {
+                memcpy( prev_map, map, OSD_MAP_SIZE );
+                continue;
+            }
+
+            memcpy( &fh, frame, sizeof(fh) );
+            put_record( path, fh.frame_idx, codes );
+
+            memcpy( prev_map, map, OSD_MAP_SIZE );
+            memcpy( prev_codes, codes, codes_size );
+            have_prev = true;
+        }
+    }
+
+    if ( ferror( fp ) )
+        fprintf( stderr, "%s: read error\n", path );
+
+    fclose( fp );
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    const char *out_path = NULL;
+    int opt;
+    int rtn = EXIT_SUCCESS;
+
+    cfg.format = OUTPUT_CSV;
+    cfg.fps = 60;
+    cfg.variant = -1;
+    cfg.trim = true;
+    cfg.placeholder = "";
+    cfg.out = stdout;
+
+    while ( (opt = getopt( argc, argv, "r:F:f:v:m:u:ano:h" )) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            if ( parse_region( optarg ) )
+                return EXIT_FAILURE;
+            break;
+        case 'F':
+            if ( !strcmp( optarg, "csv" ) )
+                cfg.format = OUTPUT_CSV;
+            else if ( !strcmp( optarg, "ndjson" ) )
+                cfg.format = OUTPUT_NDJSON;
+            else
+            {
+                fprintf( stderr, "Unknown format \"%s\"\n", optarg );
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            cfg.fps = atof( optarg );
+            if ( cfg.fps <= 0 )
+                cfg.fps = 60;
+            break;
+        case 'v':
+            cfg.variant = parse_variant( optarg );
+            if ( cfg.variant < 0 )
+            {
+                fprintf( stderr, "Unknown font variant \"%s\"\n", optarg );
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm':
+            if ( load_user_map( optarg ) )
+                return EXIT_FAILURE;
+            break;
+        case 'u':
+            cfg.placeholder = optarg;
+            break;
+        case 'a':
+            cfg.all_frames = true;
+            break;
+        case 'n':
+            cfg.trim = false;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            usage( argv[0] );
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if ( optind >= argc )
+    {
+        usage( argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    // Default: every row of the screen
+    if ( cfg.region_count == 0 )
+    {
+        for ( int y = 0; y < MAX_Y; y++ )
+        {
+            region_t *r = &cfg.regions[cfg.region_count++];
+            snprintf( r->name, sizeof(r->name), "row%02d", y );
+            r->x = 0;
+            r->y = y;
+            r->w = MAX_X;
+        }
+    }
+    for ( int i = 0; i < cfg.region_count; i++ )
+        cfg.region_cells += cfg.regions[i].w;
+
+    if ( out_path )
+    {
+        cfg.out = fopen( out_path, "w" );
+        if ( cfg.out == NULL )
+        {
+            fprintf( stderr, "%s: %s\n", out_path, strerror(errno) );
+            return EXIT_FAILURE;
+        }
+    }
+    setvbuf( cfg.out, NULL, _IOFBF, 1 << 16 );
+
+    put_header();
+    for ( int i = optind; i < argc; i++ )
+    {
+        if ( process_file( argv[i] ) )
+            rtn = EXIT_FAILURE;
+    }
+
+    if ( fclose( cfg.out ) )
+        rtn = EXIT_FAILURE;
+    return rtn;
+}
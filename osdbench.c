@@ -0,0 +1,179 @@
+/*****************************************************************************
+ * osdbench : benchmark of the glyph blitting kernels
+ *****************************************************************************
+ * Draws full OSD frames with the generic and the specialized kernel for
+ * each font geometry and pixel format, checks that both produce the same
+ * canvas and prints the time per glyph.
+ *
+ * Usage: osdbench [frames]
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "fpvosd.h"
+#include "fpvosd_blit.h"
+
+#define BENCH_FRAMES  2000
+
+typedef struct geometry_s
+{
+    const char *name;
+    int cw, ch;
+    int cols, rows;         // grid
+} geometry_t;
+
+static const geometry_t geometries[] = {
+    { "HD", FONT_WIDTH, FONT_HEIGHT, MAX_X, MAX_Y },
+    { "SD", FONT_SD_WIDTH, FONT_SD_HEIGHT, 30, 15 },
+};
+
+static const char * format_str[OSD_BLIT__SIZE] = {
+        [OSD_BLIT_YUVA]="YUVA",
+        [OSD_BLIT_RGBA]="RGBA",
+};
+
+typedef struct image_s
+{
+    osd_plane_t planes[OSD_BLIT_MAX_PLANES];
+    int count;
+    size_t plane_size;
+} image_t;
+
+static int image_new( image_t *img, int format, int width, int height )
+{
+    const int pixel_pitch = format == OSD_BLIT_YUVA ? 1 : 4;
+
+    img->count = format == OSD_BLIT_YUVA ? 4 : 1;
+    img->plane_size = (size_t)width * pixel_pitch * height;
+    for ( int i = 0; i < img->count; i++ )
+    {
+        img->planes[i].pitch = width * pixel_pitch;
+        img->planes[i].pixels = malloc( img->plane_size );
+        if ( img->planes[i].pixels == NULL )
+            return -1;
+        for ( size_t j = 0; j < img->plane_size; j++ )
+            img->planes[i].pixels[j] = rand();
+    }
+    return 0;
+}
+
+static void image_free( image_t *img )
+{
+    for ( int i = 0; i < img->count; i++ )
+        free( img->planes[i].pixels );
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Draws the frames, returns seconds */
+static double draw( const osd_blit_t *b, const image_t *canvas, const geometry_t *g,
+                    const uint16_t *map, int frames )
+{
+    double t0 = now();
+
+    for ( int f = 0; f < frames; f++ )
+        for ( int x = 0; x < g->cols; x++ )
+            for ( int y = 0; y < g->rows; y++ )
+            {
+                uint16_t c = map[g->rows * x + y];
+                if ( c != 0 )
+                    b->blit( b, canvas->planes, x * g->cw, y * g->ch, c & 0xFF );
+            }
+
+    return now() - t0;
+}
+
+static int bench( const geometry_t *g, int format, int frames )
+{
+    const int width = g->cols * g->cw, height = g->rows * g->ch;
+    image_t font, canvas_generic, canvas;
+    osd_blit_t generic, specialized;
+    uint16_t *map;
+    unsigned glyphs = 0;
+    double t_generic, t_specialized;
+    int rtn = -1;
+
+    memset( &font, 0, sizeof(font) );
+    memset( &canvas_generic, 0, sizeof(canvas_generic) );
+    memset( &canvas, 0, sizeof(canvas) );
+
+    map = calloc( g->cols * g->rows, sizeof(*map) );
+    if ( map == NULL ||
+         image_new( &font, format, g->cw * FONT_PAGE_CHARS, g->ch ) ||
+         image_new( &canvas_generic, format, width, height ) ||
+         image_new( &canvas, format, width, height ) )
+    {
+        fprintf( stderr, "Out of memory\n" );
+        goto cleanup;
+    }
+
+    // A typical OSD fills about a quarter of the cells
+    for ( int i = 0; i < g->cols * g->rows; i++ )
+    {
+        map[i] = rand() % 4 == 0 ? 1 + rand() % 255 : 0;
+        glyphs += map[i] != 0;
+    }
+
+    osd_blit_get( &specialized, format, g->cw, g->ch, font.planes );
+    generic = specialized;
+    generic.blit = osd_blit_generic;
+    generic.name = "generic";
+
+    // Warm up and check
+    for ( int i = 0; i < canvas.count; i++ )
+        memcpy( canvas.planes[i].pixels, canvas_generic.planes[i].pixels, canvas.plane_size );
+    draw( &generic, &canvas_generic, g, map, 1 );
+    draw( &specialized, &canvas, g, map, 1 );
+    for ( int i = 0; i < canvas.count; i++ )
+    {
+        if ( memcmp( canvas.planes[i].pixels, canvas_generic.planes[i].pixels, canvas.plane_size ) )
+        {
+            fprintf( stderr, "%s %s: %s kernel output differs from generic\n",
+                     g->name, format_str[format], specialized.name );
+            goto cleanup;
+        }
+    }
+
+    t_generic = draw( &generic, &canvas_generic, g, map, frames );
+    t_specialized = draw( &specialized, &canvas, g, map, frames );
+
+    printf( "%s %dx%d %s: generic %.1f ns/glyph, %s %.1f ns/glyph (x%.2f)\n",
+            g->name, g->cw, g->ch, format_str[format],
+            t_generic * 1e9 / ( (double)glyphs * frames ),
+            specialized.name, t_specialized * 1e9 / ( (double)glyphs * frames ),
+            t_specialized > 0 ? t_generic / t_specialized : 0.0 );
+    rtn = 0;
+
+cleanup:
+    image_free( &font );
+    image_free( &canvas_generic );
+    image_free( &canvas );
+    free( map );
+    return rtn;
+}
+
+int main( int argc, char **argv )
+{
+    int frames = argc > 1 ? atoi( argv[1] ) : BENCH_FRAMES;
+    int rtn = EXIT_SUCCESS;
+
+    if ( frames < 1 )
+        frames = BENCH_FRAMES;
+
+    srand( 1 );
+    for ( unsigned g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++ )
+        for ( int format = 0; format < OSD_BLIT__SIZE; format++ )
+            if ( bench( &geometries[g], format, frames ) )
+                rtn = EXIT_FAILURE;
+
+    return rtn;
+}
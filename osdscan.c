@@ -0,0 +1,849 @@
+/*****************************************************************************
+ * osdscan : checks and repairs MSP-OSD (.osd) files
+ *****************************************************************************
+ * Files are memory-mapped and checked by a pool of threads; directories
+ * are scanned recursively for .osd files. Reported problems:
+ *  - bad or truncated file header
+ *  - frame record with a size other than the 60x22 map
+ *  - duplicated or non-monotonic frame numbers
+ *  - frame numbers ahead of both neighbours
+ *  - glyph codes beyond the two font pages (> 0x1FF)
+ *  - truncated last frame
+ * With -o the damaged files are written repaired to a folder, under their
+ * path relative to the scanned folder: bad records and out-of-order frames
+ * are dropped, invalid glyphs are cleared and the file is cut at the last
+ * complete frame.
+ *
+ * Usage: osdscan [options] file.osd|folder ...
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <direct.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+#endif
+
+#include "fpvosd.h"
+
+// Highest valid glyph code: two font pages
+#define GLYPH_MAX           0x1FF
+// Problems of one kind reported per file, the rest are only counted
+#define REPORT_MAX          5
+// Mapped pages are released after each window to bound resident memory
+#define SCAN_WINDOW         (64 << 20)
+// Resync: a frame number may jump ahead by not more than this
+#define RESYNC_MAX_GAP      (60 * 60 * 60)
+
+#ifdef _WIN32
+# define PATH_SEP  '\\'
+# define make_dir( path )  _mkdir( path )
+#else
+# define PATH_SEP  '/'
+# define make_dir( path )  mkdir( path, 0777 )
+#endif
+
+enum problem_e
+{
+    PROBLEM_SIZE = 0,       // record size is not the map size
+    PROBLEM_DUPLICATE,
+    PROBLEM_ORDER,          // frame number goes back
+    PROBLEM_JUMP,           // frame number ahead, the next frame continues from before it
+    PROBLEM_GLYPH,
+    PROBLEM__SIZE
+};
+
+static const char * problem_str[PROBLEM__SIZE] = {
+        [PROBLEM_SIZE]="bad frame size",
+        [PROBLEM_DUPLICATE]="duplicated frame",
+        [PROBLEM_ORDER]="non-monotonic frame",
+        [PROBLEM_JUMP]="frame number out of sequence",
+        [PROBLEM_GLYPH]="invalid glyph codes",
+};
+
+typedef struct mapped_file_s
+{
+    const uint8_t *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+} mapped_file_t;
+
+typedef struct scan_result_s
+{
+    uint64_t frames;                    // good frames
+    uint64_t count[PROBLEM__SIZE];
+    uint64_t skipped_bytes;             // not parsed as frames
+    size_t tail_bytes;                  // incomplete last frame
+    bool b_header_bad;
+} scan_result_t;
+
+static struct
+{
+    unsigned threads;
+    const char *out_dir;
+    bool b_quiet;
+} cfg;
+
+// File to scan
+typedef struct scan_file_s
+{
+    char *path;
+    size_t rel;                         // path relative to the scanned folder
+} scan_file_t;
+
+// Files to scan
+static scan_file_t *files;
+static size_t files_count, files_alloc;
+static size_t files_next;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Repaired copies written so far, two files never get the same one
+static char **outputs;
+static size_t outputs_count, outputs_alloc;
+static pthread_mutex_t outputs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Report lines of different files are not mixed
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Totals
+static uint64_t total_bytes, total_damaged, total_errors, total_repaired;
+
+
+static void usage( const char *prog )
+{
+    fprintf( stderr,
+        "Usage: %s [options] file.osd|folder ...\n"
+        "  -j threads  number of threads (default: number of CPUs)\n"
+        "  -o folder   write repaired copies of damaged files to the folder\n"
+        "  -q          report damaged files only, without details\n",
+        prog );
+}
+
+/*****************************************************************************
+ * File list
+ *****************************************************************************/
+static int files_add( const char *path, size_t rel )
+{
+    if ( files_count == files_alloc )
+    {
+        size_t n = files_alloc ? files_alloc * 2 : 256;
+        scan_file_t *p = realloc( files, n * sizeof(*files) );
+        if ( p == NULL )
+            return -1;
+        files = p;
+        files_alloc = n;
+    }
+    files[files_count].path = strdup( path );
+    if ( files[files_count].path == NULL )
+        return -1;
+    files[files_count].rel = rel;
+    files_count++;
+    return 0;
+}
+
+static bool has_osd_ext( const char *name )
+{
+    size_t len = strlen( name );
+    return len > 4 && ( !strcmp( name + len - 4, ".osd" ) || !strcmp( name + len - 4, ".OSD" ) );
+}
+
+/* rel is the length of the scanned folder path and the separator */
+static int files_add_dir( const char *dir, size_t rel )
+{
+    DIR *d = opendir( dir );
+    struct dirent *e;
+    int rtn = 0;
+
+    if ( d == NULL )
+    {
+        fprintf( stderr, "%s: %s\n", dir, strerror(errno) );
+        return 0;
+    }
+
+    while ( rtn == 0 && ( e = readdir( d ) ) != NULL )
+    {
+        char path[4096];
+        struct stat st;
+
+        if ( !strcmp( e->d_name, "." ) || !strcmp( e->d_name, ".." ) )
+            continue;
+        snprintf( path, sizeof(path), "%s%c%s", dir, PATH_SEP, e->d_name );
+        if ( stat( path, &st ) )
+            continue;
+        if ( S_ISDIR( st.st_mode ) )
+            rtn = files_add_dir( path, rel );
+        else if ( S_ISREG( st.st_mode ) && has_osd_ext( e->d_name ) )
+            rtn = files_add( path, rel );
+    }
+
+    closedir( d );
+    return rtn;
+}
+
+static const scan_file_t * files_take( void )
+{
+    const scan_file_t *file = NULL;
+
+    pthread_mutex_lock( &files_lock );
+    if ( files_next < files_count )
+        file = &files[files_next++];
+    pthread_mutex_unlock( &files_lock );
+    return file;
+}
+
+static bool is_sep( char c )
+{
+#ifdef _WIN32
+    if ( c == '/' )
+        return true;
+#endif
+    return c == PATH_SEP;
+}
+
+/*****************************************************************************
+ * Repaired copies
+ *****************************************************************************/
+/* Creates the folders of path */
+static void make_dirs( char *path )
+{
+    for ( char *p = path + 1; *p; p++ )
+    {
+        if ( !is_sep( *p ) )
+            continue;
+        *p = '\0';
+        make_dir( path );
+        *p = PATH_SEP;
+    }
+}
+
+/* Reserves path for this run; a name taken by another file gets a number */
+static int outputs_reserve( char *path, size_t size )
+{
+    const char *dot = strrchr( path, '.' );
+    size_t base_len = strlen( path );
+    char ext[16] = "";
+    int rtn = 0;
+
+    if ( dot && !strchr( dot, PATH_SEP ) && strlen( dot ) < sizeof(ext) )
+    {
+        strcpy( ext, dot );
+        base_len = dot - path;
+    }
+
+    pthread_mutex_lock( &outputs_lock );
+    for ( unsigned n = 2; ; n++ )
+    {
+        size_t i;
+        for ( i = 0; i < outputs_count && strcmp( outputs[i], path ); i++ )
+            ;
+        if ( i == outputs_count )
+            break;
+        snprintf( path + base_len, size - base_len, "-%u%s", n, ext );
+    }
+    if ( outputs_count == outputs_alloc )
+    {
+        size_t n = outputs_alloc ? outputs_alloc * 2 : 64;
+        char **p = realloc( outputs, n * sizeof(*outputs) );
+        if ( p == NULL )
+            rtn = -1;
+        else
+        {
+            outputs = p;
+            outputs_alloc = n;
+        }
+    }
+    if ( rtn == 0 && ( outputs[outputs_count] = strdup( path ) ) != NULL )
+        outputs_count++;
+    else
+        rtn = -1;
+    pthread_mutex_unlock( &outputs_lock );
+    return rtn;
+}
+
+/*****************************************************************************
+ * Memory mapping
+ *****************************************************************************/
+static int map_file( const char *path, mapped_file_t *m )
+{
+    memset( m, 0, sizeof(*m) );
+
+#ifdef _WIN32
+    LARGE_INTEGER size;
+
+    m->file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if ( m->file == INVALID_HANDLE_VALUE )
+        return -1;
+    if ( !GetFileSizeEx( m->file, &size ) )
+    {
+        CloseHandle( m->file );
+        return -1;
+    }
+    m->size = size.QuadPart;
+    if ( m->size == 0 )
+        return 0;
+    m->mapping = CreateFileMappingA( m->file, NULL, PAGE_READONLY, 0, 0, NULL );
+    if ( m->mapping == NULL )
+    {
+        CloseHandle( m->file );
+        return -1;
+    }
+    m->data = MapViewOfFile( m->mapping, FILE_MAP_READ, 0, 0, 0 );
+    if ( m->data == NULL )
+    {
+        CloseHandle( m->mapping );
+        CloseHandle( m->file );
+        return -1;
+    }
+#else
+    struct stat st;
+    int fd = open( path, O_RDONLY );
+
+    if ( fd < 0 )
+        return -1;
+    if ( fstat( fd, &st ) )
+    {
+        close( fd );
+        return -1;
+    }
+    m->size = st.st_size;
+    if ( m->size > 0 )
+    {
+        void *p = mmap( NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( p == MAP_FAILED )
+        {
+            close( fd );
+            return -1;
+        }
+        m->data = p;
+# ifdef MADV_SEQUENTIAL
+        madvise( p, m->size, MADV_SEQUENTIAL );
+# endif
+    }
+    close( fd );
+#endif
+    return 0;
+}
+
+/* Drops the pages of [0, end) from the process: they will not be read again */
+static void map_release( const mapped_file_t *m, size_t end )
+{
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+    long page = sysconf( _SC_PAGESIZE );
+    end -= end % page;
+    if ( end > 0 )
+        madvise( (void *)m->data, end, MADV_DONTNEED );
+#else
+    (void)m; (void)end;
+#endif
+}
+
+static void unmap_file( mapped_file_t *m )
+{
+#ifdef _WIN32
+    if ( m->data )
+        UnmapViewOfFile( m->data );
+    if ( m->mapping )
+        CloseHandle( m->mapping );
+    CloseHandle( m->file );
+#else
+    if ( m->data )
+        munmap( (void *)m->data, m->size );
+#endif
+}
+
+/*****************************************************************************
+ * Scanning
+ *****************************************************************************/
+typedef struct report_s
+{
+    const char *path;
+    char *text;
+    size_t len, alloc;
+    bool b_mute;
+} report_t;
+
+static void report( report_t *r, const char *fmt, ... )
+{
+    va_list args;
+    int n;
+
+    if ( cfg.b_quiet || r->b_mute )
+        return;
+
+    for ( ;; )
+    {
+        size_t avail = r->alloc - r->len;
+
+        va_start( args, fmt );
+        n = vsnprintf( r->text ? r->text + r->len : NULL, avail, fmt, args );
+        va_end( args );
+        if ( n < 0 )
+            return;
+        if ( (size_t)n < avail )
+            break;
+
+        size_t alloc = r->alloc * 2 + n + 1;
+        char *p = realloc( r->text, alloc );
+        if ( p == NULL )
+            return;
+        r->text = p;
+        r->alloc = alloc;
+    }
+    r->len += n;
+}
+
+static void report_problem( report_t *r, scan_result_t *res, enum problem_e problem,
+                            size_t offset, const frame_header_t *hdr, const char *detail )
+{
+    if ( ++res->count[problem] <= REPORT_MAX )
+        report( r, "%s: offset %zu: frame %u: %s%s\n", r->path, offset, hdr->frame_idx,
+                problem_str[problem], detail ? detail : "" );
+}
+
+static bool header_plausible( const frame_header_t *hdr, uint32_t last_idx, bool b_have_last )
+{
+    return hdr->size == OSD_MAP_SIZE &&
+           ( !b_have_last || ( hdr->frame_idx > last_idx && hdr->frame_idx - last_idx <= RESYNC_MAX_GAP ) );
+}
+
+/* Offset of the next record that looks like a frame, or size if none */
+static size_t resync( const mapped_file_t *m, size_t offset, uint32_t last_idx, bool b_have_last )
+{
+    for ( offset += 2; offset + OSD_FRAME_SIZE <= m->size; offset += 2 )
+    {
+        frame_header_t hdr;
+        memcpy( &hdr, m->data + offset, sizeof(hdr) );
+        if ( header_plausible( &hdr, last_idx, b_have_last ) )
+            return offset;
+    }
+    return m->size;
+}
+
+/* True if the frame number at offset jumps ahead of last_idx while the next
+ * record continues from last_idx, i.e. the number itself is damaged. Without
+ * a next record only a jump beyond RESYNC_MAX_GAP is taken as damage */
+static bool frame_idx_outlier( const mapped_file_t *m, size_t offset, uint32_t frame_idx, uint32_t last_idx )
+{
+    const bool b_far = frame_idx - last_idx > RESYNC_MAX_GAP;
+    frame_header_t next;
+
+    if ( frame_idx - last_idx <= 1 )
+        return false;
+    if ( offset + 2 * OSD_FRAME_SIZE > m->size )
+        return b_far;
+
+    memcpy( &next, m->data + offset + OSD_FRAME_SIZE, sizeof(next) );
+    if ( next.size != OSD_MAP_SIZE )
+        return b_far;
+    return header_plausible( &next, last_idx, true ) && next.frame_idx < frame_idx;
+}
+
+/* Number of glyph codes beyond the font pages */
+static unsigned glyphs_invalid( const uint16_t *map )
+{
+    uint16_t bits = 0;
+    unsigned n = 0;
+
+    // Fast path: the whole map is checked at once
+    for ( int i = 0; i < MAX_X * MAX_Y; i++ )
+        bits |= map[i];
+    if ( ( bits & ~GLYPH_MAX ) == 0 )
+        return 0;
+
+    for ( int i = 0; i < MAX_X * MAX_Y; i++ )
+        n += map[i] > GLYPH_MAX;
+    return n;
+}
+
+/* Checks a file; good frames are written to out if it is not NULL */
+static int scan( const mapped_file_t *m, report_t *r, scan_result_t *res, FILE *out )
+{
+    file_header_t file_hdr;
+    size_t offset = sizeof(file_hdr), released = 0;
+    uint32_t last_idx = 0;
+    bool b_have_last = false;
+
+    memset( res, 0, sizeof(*res) );
+
+    if ( m->size < sizeof(file_hdr) )
+    {
+        res->b_header_bad = true;
+        report( r, "%s: truncated file header (%zu bytes)\n", r->path, m->size );
+        return 0;
+    }
+    memcpy( &file_hdr, m->data, sizeof(file_hdr) );
+    if ( memcmp( file_hdr.magic, MAGIC, sizeof(file_hdr.magic) ) || file_hdr.version != MSPOSD_VERSION )
+    {
+        res->b_header_bad = true;
+        report( r, "%s: not an MSP-OSD v%d file\n", r->path, MSPOSD_VERSION );
+        return 0;
+    }
+    if ( file_hdr.config.font_variant >= FONT_VARIANT__SIZE )
+        report( r, "%s: unknown font variant %u\n", r->path, file_hdr.config.font_variant );
+
+    if ( out && fwrite( &file_hdr, sizeof(file_hdr), 1, out ) != 1 )
+        return -1;
+
+    while ( offset + sizeof(frame_header_t) <= m->size )
+    {
+        frame_header_t hdr;
+        uint16_t map[MAX_X * MAX_Y];
+        unsigned invalid;
+
+        if ( offset - released >= SCAN_WINDOW )
+        {
+            map_release( m, offset );
+            released = offset;
+        }
+
+        memcpy( &hdr, m->data + offset, sizeof(hdr) );
+
+        if ( hdr.size != OSD_MAP_SIZE )
+        {
+            size_t next = resync( m, offset, last_idx, b_have_last );
+            char detail[64];
+            snprintf( detail, sizeof(detail), " %u, %zu bytes skipped", hdr.size, next - offset );
+            report_problem( r, res, PROBLEM_SIZE, offset, &hdr, detail );
+            res->skipped_bytes += next - offset;
+            offset = next;
+            continue;
+        }
+        if ( offset + OSD_FRAME_SIZE > m->size )
+            break;
+
+        if ( b_have_last && hdr.frame_idx <= last_idx )
+        {
+            report_problem( r, res, hdr.frame_idx == last_idx ? PROBLEM_DUPLICATE : PROBLEM_ORDER,
+                            offset, &hdr, NULL );
+            offset += OSD_FRAME_SIZE;
+            continue;
+        }
+        if ( b_have_last && frame_idx_outlier( m, offset, hdr.frame_idx, last_idx ) )
+        {
+            char detail[48];
+            snprintf( detail, sizeof(detail), " (after %u)", last_idx );
+            report_problem( r, res, PROBLEM_JUMP, offset, &hdr, detail );
+            offset += OSD_FRAME_SIZE;
+            continue;
+        }
+
+        memcpy( map, m->data + offset + sizeof(hdr), sizeof(map) );
+        invalid = glyphs_invalid( map );
+        if ( invalid )
+        {
+            char detail[32];
+            snprintf( detail, sizeof(detail), " (%u)", invalid );
+            report_problem( r, res, PROBLEM_GLYPH, offset, &hdr, detail );
+            for ( int i = 0; i < MAX_X * MAX_Y; i++ )
+                if ( map[i] > GLYPH_MAX )
+                    map[i] = 0;
+        }
+
+        if ( out && ( fwrite( &hdr, sizeof(hdr), 1, out ) != 1 ||
+                      fwrite( map, sizeof(map), 1, out ) != 1 ) )
+            return -1;
+
+        res->frames++;
+        last_idx = hdr.frame_idx;
+        b_have_last = true;
+        offset += OSD_FRAME_SIZE;
+    }
+
+    res->tail_bytes = m->size - offset;
+    if ( res->tail_bytes )
+        report( r, "%s: offset %zu: truncated last frame (%zu of %zu bytes)\n",
+                r->path, offset, res->tail_bytes, (size_t)OSD_FRAME_SIZE );
+
+    for ( int i = 0; i < PROBLEM__SIZE; i++ )
+        if ( res->count[i] > REPORT_MAX )
+            report( r, "%s: %"PRIu64" more %s\n", r->path, res->count[i] - REPORT_MAX, problem_str[i] );
+    return 0;
+}
+
+static bool is_damaged( const scan_result_t *res )
+{
+    if ( res->b_header_bad || res->tail_bytes )
+        return true;
+    for ( int i = 0; i < PROBLEM__SIZE; i++ )
+        if ( res->count[i] )
+            return true;
+    return false;
+}
+
+/* Opens a temporary file next to out_path, renamed into place when done */
+static FILE * temp_open( const char *out_path, char *tmp_path, size_t size )
+{
+#ifdef _WIN32
+    snprintf( tmp_path, size, "%s.tmp", out_path );
+    return fopen( tmp_path, "wb" );
+#else
+    int fd;
+    FILE *f;
+
+    snprintf( tmp_path, size, "%s.XXXXXX", out_path );
+    fd = mkstemp( tmp_path );
+    if ( fd < 0 )
+        return NULL;
+    fchmod( fd, 0644 );
+    f = fdopen( fd, "wb" );
+    if ( f == NULL )
+    {
+        close( fd );
+        remove( tmp_path );
+    }
+    return f;
+#endif
+}
+
+static int temp_commit( const char *tmp_path, const char *out_path )
+{
+#ifdef _WIN32
+    return MoveFileExA( tmp_path, out_path, MOVEFILE_REPLACE_EXISTING ) ? 0 : -1;
+#else
+    return rename( tmp_path, out_path );
+#endif
+}
+
+/* The copy keeps the path of the file relative to the scanned folder */
+static int repair( const scan_file_t *file, const mapped_file_t *m, report_t *r )
+{
+    const char *path = file->path;
+    char out_path[4096], tmp_path[4096 + 8];
+    // Problems are already reported
+    report_t mute = { path, NULL, 0, 0, true };
+    scan_result_t res;
+    FILE *out;
+    int rtn;
+
+    snprintf( out_path, sizeof(out_path), "%s%c%s", cfg.out_dir, PATH_SEP, path + file->rel );
+    if ( outputs_reserve( out_path, sizeof(out_path) ) )
+    {
+        report( r, "%s: out of memory\n", path );
+        return -1;
+    }
+    make_dirs( out_path );
+
+#ifndef _WIN32
+    // The file is mapped while it is repaired: never replace it by its copy.
+    // On Windows the mapping keeps it from being replaced
+    struct stat st_in, st_out;
+    if ( stat( path, &st_in ) == 0 && stat( out_path, &st_out ) == 0 &&
+         st_in.st_dev == st_out.st_dev && st_in.st_ino == st_out.st_ino )
+    {
+        report( r, "%s: the repaired copy would replace the file itself\n", path );
+        return -1;
+    }
+#endif
+
+    out = temp_open( out_path, tmp_path, sizeof(tmp_path) );
+    if ( out == NULL )
+    {
+        report( r, "%s: %s\n", out_path, strerror(errno) );
+        return -1;
+    }
+
+    rtn = scan( m, &mute, &res, out );
+
+    if ( fclose( out ) || rtn )
+    {
+        report( r, "%s: write error\n", out_path );
+        remove( tmp_path );
+        return -1;
+    }
+    if ( temp_commit( tmp_path, out_path ) )
+    {
+        report( r, "%s: %s\n", out_path, strerror(errno) );
+        remove( tmp_path );
+        return -1;
+    }
+    report( r, "%s: repaired copy %s, %"PRIu64" frames\n", path, out_path, res.frames );
+    return 0;
+}
+
+static void scan_file( const scan_file_t *file )
+{
+    const char *path = file->path;
+    report_t r = { path, NULL, 0, 0, false };
+    mapped_file_t m;
+    scan_result_t res;
+    bool b_damaged = false, b_error = false, b_repaired = false;
+
+    if ( map_file( path, &m ) )
+    {
+        report( &r, "%s: %s\n", path, strerror(errno) );
+        b_error = true;
+    }
+    else
+    {
+        scan( &m, &r, &res, NULL );
+        b_damaged = is_damaged( &res );
+        if ( b_damaged && cfg.out_dir && !res.b_header_bad )
+        {
+            if ( repair( file, &m, &r ) )
+                b_error = true;
+            else
+                b_repaired = true;
+        }
+        unmap_file( &m );
+    }
+
+    pthread_mutex_lock( &report_lock );
+    if ( r.len )
+        fputs( r.text, stdout );
+    if ( cfg.b_quiet && b_damaged )
+        printf( "%s\n", path );
+    total_bytes += m.size;
+    total_damaged += b_damaged;
+    total_errors += b_error;
+    total_repaired += b_repaired;
+    pthread_mutex_unlock( &report_lock );
+
+    free( r.text );
+}
+
+static void * worker( void *data )
+{
+    const scan_file_t *file;
+
+    (void)data;
+    while ( ( file = files_take() ) != NULL )
+        scan_file( file );
+    return NULL;
+}
+
+static unsigned cpu_count( void )
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    return si.dwNumberOfProcessors;
+#else
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? n : 1;
+#endif
+}
+
+int main( int argc, char **argv )
+{
+    pthread_t *threads;
+    struct timespec t0, t1;
+    double seconds;
+    unsigned started = 0;
+    int opt;
+
+    cfg.threads = cpu_count();
+
+    while ( (opt = getopt( argc, argv, "j:o:qh" )) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'j':
+            cfg.threads = atoi( optarg );
+            if ( cfg.threads < 1 )
+                cfg.threads = 1;
+            break;
+        case 'o':
+            cfg.out_dir = optarg;
+            break;
+        case 'q':
+            cfg.b_quiet = true;
+            break;
+        default:
+            usage( argv[0] );
+            return opt == 'h' ? EXIT_SUCCESS : 2;
+        }
+    }
+
+    if ( optind >= argc )
+    {
+        usage( argv[0] );
+        return 2;
+    }
+
+    for ( int i = optind; i < argc; i++ )
+    {
+        struct stat st;
+        int rtn;
+
+        if ( stat( argv[i], &st ) )
+        {
+            fprintf( stderr, "%s: %s\n", argv[i], strerror(errno) );
+            total_errors++;
+            continue;
+        }
+        if ( S_ISDIR( st.st_mode ) )
+        {
+            rtn = files_add_dir( argv[i], strlen( argv[i] ) + 1 );
+        }
+        else
+        {
+            size_t rel = strlen( argv[i] );
+            while ( rel > 0 && !is_sep( argv[i][rel - 1] ) )
+                rel--;
+            rtn = files_add( argv[i], rel );
+        }
+        if ( rtn )
+        {
+            fprintf( stderr, "Out of memory\n" );
+            return 2;
+        }
+    }
+
+    if ( cfg.threads > files_count )
+        cfg.threads = files_count ? files_count : 1;
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+
+    threads = malloc( cfg.threads * sizeof(*threads) );
+    if ( threads )
+    {
+        for ( ; started < cfg.threads; started++ )
+            if ( pthread_create( &threads[started], NULL, worker, NULL ) )
+                break;
+    }
+    // No threads: scan in this one
+    if ( started == 0 )
+        worker( NULL );
+    for ( unsigned i = 0; i < started; i++ )
+        pthread_join( threads[i], NULL );
+    free( threads );
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    fflush( stdout );
+    seconds = ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) / 1e9;
+
+    fprintf( stderr, "%zu files, %"PRIu64" damaged, %"PRIu64" repaired, %"PRIu64" errors; "
+             "%.1f MB in %.2f s (%.0f MB/s, %u threads)\n",
+             files_count, total_damaged, total_repaired, total_errors,
+             total_bytes / 1e6, seconds, seconds > 0 ? total_bytes / 1e6 / seconds : 0.0,
+             started ? started : 1 );
+
+    for ( size_t i = 0; i < files_count; i++ )
+        free( files[i].path );
+    free( files );
+    for ( size_t i = 0; i < outputs_count; i++ )
+        free( outputs[i] );
+    free( outputs );
+
+    if ( total_errors )
+        return 2;
+    return total_damaged ? 1 : 0;
+}